@@ -0,0 +1,59 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "./include/kaiju_server.h"
+
+struct bench_options {
+    int outputs;
+    int clients;
+    /** Buffer commits per second, per client */
+    int commit_rate;
+    /** Synthetic input events per second */
+    int input_rate;
+    /** Seconds to measure for, after the warmup */
+    int duration;
+    int width, height;
+    /** Only damage a small part of each buffer on commit */
+    bool partial_damage;
+    /** Share buffers through linux-dmabuf, backed by udmabuf, instead of shm */
+    bool dmabuf;
+    /** Draw every surface on its own instead of batching them */
+    bool unbatched;
+    /** Measure once batched and once unbatched */
+    bool compare;
+    /** Attach a stand-in bridge with a columns layout once the views are up,
+     * and check that it was applied */
+    bool layout;
+    /** Dump the full statistics as JSON at the end */
+    bool verbose;
+};
+
+struct bench_client;
+
+struct bench {
+    struct bench_options options;
+    struct kaiju_server server;
+    struct bench_client **clients;
+
+    struct wlr_input_device *pointer;
+    struct wlr_input_device *keyboard;
+    struct wl_event_source *warmup_timer;
+    struct wl_event_source *input_timer;
+    struct wl_event_source *end_timer;
+    bool measuring;
+
+    uint64_t input_events;
+    int64_t input_time;
+    uint64_t commits;
+    /** Clients whose dmabufs the compositor imported */
+    int dmabuf_clients;
+    /** Average repaint time of the batched run, when comparing */
+    double batched_repaint;
+    /** Set if a check failed, makes kaiju-bench exit with an error */
+    bool failed;
+};
+
+/** Connects an in-process shm or dmabuf client to the server, which maps a single
+ * toplevel and then keeps committing buffers at the configured rate */
+struct bench_client *bench_client_create(struct bench *bench, int index);
+void bench_client_destroy(struct bench_client *client);
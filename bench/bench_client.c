@@ -0,0 +1,351 @@
+#define _GNU_SOURCE
+
+#include <drm_fourcc.h>
+#include <fcntl.h>
+#include <linux/udmabuf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include <wayland-server-core.h>
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+#include "./bench/bench.h"
+
+/* The client half of the benchmark. It lives in the same process and thread
+ * as the compositor, so it never blocks: its socket is watched by the
+ * compositor's event loop and everything happens from callbacks. */
+struct bench_client {
+    struct bench *bench;
+    int index;
+
+    struct wl_display *display;
+    struct wl_event_source *readable;
+    struct wl_event_source *commit_timer;
+
+    struct wl_registry *registry;
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct xdg_wm_base *wm_base;
+    struct zwp_linux_dmabuf_v1 *linux_dmabuf;
+    /** Whether the compositor takes linear XRGB8888 dmabufs */
+    bool dmabuf_linear;
+
+    struct wl_surface *surface;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *toplevel;
+
+    struct wl_buffer *buffers[2];
+    /** memfd backing both buffers, kept open until they are created */
+    int fd;
+    uint32_t *pixels;
+    size_t size;
+    /** dmabuf imports the compositor still has to answer */
+    struct zwp_linux_buffer_params_v1 *params[2];
+    int pending_buffers;
+    bool dmabuf_failed;
+    int current;
+    bool configured;
+};
+
+static void wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial) {
+    xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+        .ping = wm_base_ping,
+};
+
+static void client_start(struct bench_client *client);
+
+static void client_create_shm_buffers(struct bench_client *client) {
+    int width = client->bench->options.width;
+    int height = client->bench->options.height;
+    int stride = width * 4;
+    struct wl_shm_pool *pool = wl_shm_create_pool(client->shm, client->fd, client->size);
+    for (int i = 0; i < 2; i++) {
+        client->buffers[i] = wl_shm_pool_create_buffer(pool, i * stride * height,
+                                                       width, height, stride, WL_SHM_FORMAT_XRGB8888);
+    }
+    wl_shm_pool_destroy(pool);
+}
+
+static void client_buffers_ready(struct bench_client *client) {
+    if (client->dmabuf_failed) {
+        for (int i = 0; i < 2; i++) {
+            if (client->buffers[i] != NULL) wl_buffer_destroy(client->buffers[i]);
+        }
+        client_create_shm_buffers(client);
+    } else if (client->bench->options.dmabuf) {
+        client->bench->dmabuf_clients++;
+    }
+    close(client->fd);
+    client->fd = -1;
+    client_start(client);
+}
+
+static void client_dmabuf_done(struct bench_client *client, struct zwp_linux_buffer_params_v1 *params,
+                               struct wl_buffer *buffer) {
+    for (int i = 0; i < 2; i++) {
+        if (client->params[i] != params) continue;
+        client->params[i] = NULL;
+        client->buffers[i] = buffer;
+    }
+    zwp_linux_buffer_params_v1_destroy(params);
+    if (--client->pending_buffers == 0) client_buffers_ready(client);
+}
+
+static void params_created(void *data, struct zwp_linux_buffer_params_v1 *params, struct wl_buffer *buffer) {
+    client_dmabuf_done(data, params, buffer);
+}
+
+static void params_failed(void *data, struct zwp_linux_buffer_params_v1 *params) {
+    struct bench_client *client = data;
+    if (!client->dmabuf_failed) {
+        fprintf(stderr, "Benchmark client %d: dmabuf import failed, falling back to shm\n", client->index);
+    }
+    client->dmabuf_failed = true;
+    client_dmabuf_done(client, params, NULL);
+}
+
+static const struct zwp_linux_buffer_params_v1_listener params_listener = {
+        .created = params_created,
+        .failed = params_failed,
+};
+
+static bool client_create_dmabufs(struct bench_client *client) {
+    /* udmabuf turns our memfd into a dmabuf, so this needs no GPU on our
+     * side: the compositor imports the very pages we draw into. */
+    if (client->linux_dmabuf == NULL || !client->dmabuf_linear) {
+        fprintf(stderr, "Benchmark client %d: compositor takes no linear XRGB8888 dmabufs, "
+                        "using shm\n", client->index);
+        return false;
+    }
+    int device = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (device < 0) {
+        perror("Failed to open /dev/udmabuf, using shm");
+        return false;
+    }
+    struct udmabuf_create create = {
+            .memfd = client->fd,
+            .flags = UDMABUF_FLAGS_CLOEXEC,
+            .offset = 0,
+            .size = client->size,
+    };
+    int dmabuf = ioctl(device, UDMABUF_CREATE, &create);
+    close(device);
+    if (dmabuf < 0) {
+        perror("Failed to create udmabuf, using shm");
+        return false;
+    }
+
+    int width = client->bench->options.width;
+    int height = client->bench->options.height;
+    int stride = width * 4;
+    for (int i = 0; i < 2; i++) {
+        struct zwp_linux_buffer_params_v1 *params = zwp_linux_dmabuf_v1_create_params(client->linux_dmabuf);
+        zwp_linux_buffer_params_v1_add(params, dmabuf, 0, i * stride * height, stride,
+                                       DRM_FORMAT_MOD_LINEAR >> 32, DRM_FORMAT_MOD_LINEAR & 0xffffffff);
+        zwp_linux_buffer_params_v1_add_listener(params, &params_listener, client);
+        zwp_linux_buffer_params_v1_create(params, width, height, DRM_FORMAT_XRGB8888, 0);
+        client->params[i] = params;
+    }
+    client->pending_buffers = 2;
+    /* The fd is duplicated when the requests are marshalled */
+    close(dmabuf);
+    return true;
+}
+
+static void client_create_buffers(struct bench_client *client) {
+    int width = client->bench->options.width;
+    int height = client->bench->options.height;
+    int stride = width * 4;
+    /* udmabuf only takes whole pages */
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    client->size = ((size_t) stride * height * 2 + page - 1) / page * page;
+
+    client->fd = memfd_create("kaiju-bench", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (client->fd < 0 || ftruncate(client->fd, client->size) < 0 ||
+        fcntl(client->fd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+        perror("Failed to allocate client buffers");
+        return;
+    }
+    client->pixels = mmap(NULL, client->size, PROT_READ | PROT_WRITE, MAP_SHARED, client->fd, 0);
+    if (client->pixels == MAP_FAILED) {
+        perror("Failed to map client buffers");
+        client->pixels = NULL;
+        return;
+    }
+
+    /* dmabufs are only usable once the compositor confirms the import */
+    if (!client->bench->options.dmabuf || !client_create_dmabufs(client)) {
+        client_buffers_ready(client);
+    }
+}
+
+static void client_draw(struct bench_client *client) {
+    /* Fills the part of the next buffer which we are going to damage, so that
+     * the compositor really has new content to upload. */
+    struct bench_options *options = &client->bench->options;
+    int width = options->width, height = options->height;
+    int damage_width = options->partial_damage ? width / 8 : width;
+    int damage_height = options->partial_damage ? height / 8 : height;
+    uint32_t *pixels = client->pixels + (size_t) client->current * width * height;
+    uint32_t color = 0xff000000 | (uint32_t) (client->index * 0x3f1f0f + client->bench->commits * 0x010101);
+    for (int y = 0; y < damage_height; y++) {
+        for (int x = 0; x < damage_width; x++) {
+            pixels[y * width + x] = color;
+        }
+    }
+
+    wl_surface_attach(client->surface, client->buffers[client->current], 0, 0);
+    wl_surface_damage_buffer(client->surface, 0, 0, damage_width, damage_height);
+    wl_surface_commit(client->surface);
+    wl_display_flush(client->display);
+    client->current ^= 1;
+}
+
+static int commit_interval(struct bench_client *client) {
+    /* Timers have millisecond precision, so this tops out at 1000 Hz */
+    int interval = 1000 / client->bench->options.commit_rate;
+    return interval > 0 ? interval : 1;
+}
+
+static void client_start(struct bench_client *client) {
+    client_draw(client);
+    wl_event_source_timer_update(client->commit_timer, commit_interval(client));
+}
+
+static int client_commit_timer(void *data) {
+    struct bench_client *client = data;
+    client_draw(client);
+    if (client->bench->measuring) client->bench->commits++;
+    wl_event_source_timer_update(client->commit_timer, commit_interval(client));
+    return 0;
+}
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
+    struct bench_client *client = data;
+    xdg_surface_ack_configure(xdg_surface, serial);
+    if (client->configured) return;
+
+    /* First configure: map the window and start committing once the
+     * buffers are there */
+    client->configured = true;
+    client_create_buffers(client);
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+        .configure = xdg_surface_configure,
+};
+
+static void dmabuf_format(void *data, struct zwp_linux_dmabuf_v1 *linux_dmabuf, uint32_t format) {
+    // Superseded by the modifier event
+}
+
+static void dmabuf_modifier(void *data, struct zwp_linux_dmabuf_v1 *linux_dmabuf,
+                            uint32_t format, uint32_t modifier_hi, uint32_t modifier_lo) {
+    struct bench_client *client = data;
+    uint64_t modifier = (uint64_t) modifier_hi << 32 | modifier_lo;
+    if (format == DRM_FORMAT_XRGB8888 && modifier == DRM_FORMAT_MOD_LINEAR) {
+        client->dmabuf_linear = true;
+    }
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+        .format = dmabuf_format,
+        .modifier = dmabuf_modifier,
+};
+
+static void client_create_window(struct bench_client *client) {
+    client->surface = wl_compositor_create_surface(client->compositor);
+    client->xdg_surface = xdg_wm_base_get_xdg_surface(client->wm_base, client->surface);
+    xdg_surface_add_listener(client->xdg_surface, &xdg_surface_listener, client);
+    client->toplevel = xdg_surface_get_toplevel(client->xdg_surface);
+    xdg_toplevel_set_title(client->toplevel, "kaiju-bench");
+    wl_surface_commit(client->surface);
+}
+
+static void registry_global(void *data, struct wl_registry *registry,
+                            uint32_t name, const char *interface, uint32_t version) {
+    struct bench_client *client = data;
+    if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        client->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        client->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        client->wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+        xdg_wm_base_add_listener(client->wm_base, &wm_base_listener, client);
+    } else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0 && client->bench->options.dmabuf) {
+        /* The compositor creates this global before wl_compositor, so its
+         * modifiers are in before our first configure */
+        client->linux_dmabuf = wl_registry_bind(registry, name, &zwp_linux_dmabuf_v1_interface, 3);
+        zwp_linux_dmabuf_v1_add_listener(client->linux_dmabuf, &dmabuf_listener, client);
+    }
+
+    if (client->surface == NULL && client->compositor != NULL &&
+        client->shm != NULL && client->wm_base != NULL) {
+        client_create_window(client);
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name) {
+    // Globals of interest never go away during a run
+}
+
+static const struct wl_registry_listener registry_listener = {
+        .global = registry_global,
+        .global_remove = registry_global_remove,
+};
+
+static int client_handle_readable(int fd, uint32_t mask, void *data) {
+    struct bench_client *client = data;
+    if ((mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) || wl_display_dispatch(client->display) < 0) {
+        fprintf(stderr, "Benchmark client %d lost its connection\n", client->index);
+        wl_event_source_remove(client->readable);
+        client->readable = NULL;
+        return 0;
+    }
+    wl_display_flush(client->display);
+    return 0;
+}
+
+struct bench_client *bench_client_create(struct bench *bench, int index) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        perror("Failed to create client socket");
+        return NULL;
+    }
+
+    struct bench_client *client = calloc(1, sizeof(struct bench_client));
+    client->bench = bench;
+    client->index = index;
+    client->fd = -1;
+    wl_client_create(bench->server.wl_display, fds[0]);
+    client->display = wl_display_connect_to_fd(fds[1]);
+
+    struct wl_event_loop *loop = bench->server.wl_event_loop;
+    client->readable = wl_event_loop_add_fd(loop, wl_display_get_fd(client->display),
+                                            WL_EVENT_READABLE, client_handle_readable, client);
+    client->commit_timer = wl_event_loop_add_timer(loop, client_commit_timer, client);
+
+    client->registry = wl_display_get_registry(client->display);
+    wl_registry_add_listener(client->registry, &registry_listener, client);
+    wl_display_flush(client->display);
+    return client;
+}
+
+void bench_client_destroy(struct bench_client *client) {
+    if (client == NULL) return;
+    if (client->readable != NULL) wl_event_source_remove(client->readable);
+    wl_event_source_remove(client->commit_timer);
+    if (client->pixels != NULL) munmap(client->pixels, client->size);
+    if (client->fd >= 0) close(client->fd);
+    /* Closing the connection is enough, the compositor cleans up after us */
+    wl_display_disconnect(client->display);
+    free(client);
+}
@@ -0,0 +1,426 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wayland-util.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_damage.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_pointer.h>
+
+#include "./bench/bench.h"
+#include "./include/bridge/hooks.h"
+#include "./include/kaiju_input.h"
+#include "./include/kaiju_output.h"
+#include "./include/output.h"
+#include "./include/shell/kaiju_view.h"
+#include "./include/stats.h"
+
+/* kaiju-bench runs the compositor on the headless backend and drives it with
+ * in-process clients and synthetic input, then reports how long the hot paths
+ * took. Run it before and after a change to output_frame or the input code to
+ * catch regressions. */
+
+#define BENCH_WARMUP_MS 500
+#define BENCH_HIT_TESTS 100000
+#define BENCH_KEY_INTERVAL 50
+
+static int64_t now_nsec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint32_t now_msec(void) {
+    return (uint32_t) (now_nsec() / 1000000);
+}
+
+static void bench_arrange_views(struct bench *bench) {
+    /* Cascade the views over the layout so that they overlap partially, like
+     * on a busy desktop, instead of all sitting at the origin. */
+    struct kaiju_server *server = &bench->server;
+    struct wlr_box *layout = wlr_output_layout_get_box(server->output_layout, NULL);
+    int span_x = layout->width - bench->options.width;
+    int span_y = layout->height - bench->options.height;
+    int i = 0;
+    struct kaiju_view *view;
+    wl_list_for_each(view, &server->views, link) {
+        view_damage(view, true);
+        view->props.x = layout->x + (span_x > 0 ? (i * 97) % span_x : 0);
+        view->props.y = layout->y + (span_y > 0 ? (i * 61) % span_y : 0);
+        view_index_update(&server->view_index, view);
+        view_damage(view, true);
+        i++;
+    }
+}
+
+/* Stand-in for the bridge's columns layout in Layout.kt. Like the real one it
+ * only knows the outputs it was told about through the event ring, so it
+ * does nothing unless those reach it. Hooks get no user data, hence the
+ * static state. */
+static struct {
+    bool have_output;
+    uint32_t output_id;
+    int width, height;
+    /** What the last layout pass asked for, by view */
+    struct wl_array placed; // struct view_props
+} bench_bridge;
+
+static void bench_bridge_events(struct bridge_event_ring *ring) {
+    struct bridge_event *events = (struct bridge_event *) ((char *) ring + ring->events_offset);
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (uint32_t tail = ring->tail; tail != head; tail++) {
+        struct bridge_event *event = &events[tail & (ring->capacity - 1)];
+        if (event->type == BRIDGE_EVENT_OUTPUT_ADD && !bench_bridge.have_output) {
+            bench_bridge.have_output = true;
+            bench_bridge.output_id = event->data.output.id;
+            bench_bridge.width = event->data.output.width;
+            bench_bridge.height = event->data.output.height;
+        } else if (event->type == BRIDGE_EVENT_OUTPUT_REMOVE &&
+                   event->data.output.id == bench_bridge.output_id) {
+            bench_bridge.have_output = false;
+        }
+    }
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+}
+
+static void bench_bridge_layout(struct view_props *views, uint32_t count) {
+    if (!bench_bridge.have_output) return;
+    int width = bench_bridge.width / (int) count;
+    bench_bridge.placed.size = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        views[i].x = (int) i * width;
+        views[i].y = 0;
+        views[i].width = width;
+        views[i].height = bench_bridge.height;
+        struct view_props *placed = wl_array_add(&bench_bridge.placed, sizeof(struct view_props));
+        *placed = views[i];
+    }
+}
+
+static struct bridge_hooks bench_bridge_hooks = {
+        .onEvents = bench_bridge_events,
+        .onLayout = bench_bridge_layout,
+};
+
+static void bench_check_layout(struct bench *bench) {
+    /* Every mapped view has to sit where the last layout pass put it */
+    int mapped = 0, placed = 0;
+    struct kaiju_view *view;
+    wl_list_for_each(view, &bench->server.views, link) {
+        if (!view->mapped) continue;
+        mapped++;
+        struct view_props *props;
+        wl_array_for_each(props, &bench_bridge.placed) {
+            if (props->id == view->props.id && props->x == view->props.x && props->y == view->props.y) {
+                placed++;
+                break;
+            }
+        }
+    }
+    printf("layout:   %d of %d views placed by the bridge\n", placed, mapped);
+    if (mapped == 0 || placed != mapped) {
+        fprintf(stderr, "The bridge's layout was not applied\n");
+        bench->failed = true;
+    }
+}
+
+static void bench_reset_stats(struct bench *bench) {
+    stats_reset(&bench->server);
+    bench->input_events = 0;
+    bench->input_time = 0;
+    bench->commits = 0;
+}
+
+static void bench_inject_input(struct bench *bench) {
+    /* Random walk over the layout, with a key press and release now and then */
+    uint32_t time = now_msec();
+    int64_t start = now_nsec();
+
+    struct wlr_event_pointer_motion motion = {
+            .device = bench->pointer,
+            .time_msec = time,
+            .delta_x = (rand() % 41) - 20,
+            .delta_y = (rand() % 41) - 20,
+    };
+    motion.unaccel_dx = motion.delta_x;
+    motion.unaccel_dy = motion.delta_y;
+    wl_signal_emit(&bench->pointer->pointer->events.motion, &motion);
+    wl_signal_emit(&bench->pointer->pointer->events.frame, bench->pointer->pointer);
+
+    if (bench->input_events % BENCH_KEY_INTERVAL == 0) {
+        struct wlr_event_keyboard_key key = {
+                .time_msec = time,
+                .keycode = 30, // KEY_A
+                .update_state = true,
+                .state = WLR_KEY_PRESSED,
+        };
+        wlr_keyboard_notify_key(bench->keyboard->keyboard, &key);
+        key.state = WLR_KEY_RELEASED;
+        wlr_keyboard_notify_key(bench->keyboard->keyboard, &key);
+    }
+
+    bench->input_time += now_nsec() - start;
+    bench->input_events++;
+}
+
+static int bench_input_timer(void *data) {
+    struct bench *bench = data;
+    int per_tick = bench->options.input_rate / 1000;
+    if (per_tick < 1) per_tick = 1;
+    for (int i = 0; i < per_tick; i++) {
+        bench_inject_input(bench);
+    }
+    int interval = bench->options.input_rate >= 1000 ? 1 : 1000 / bench->options.input_rate;
+    wl_event_source_timer_update(bench->input_timer, interval);
+    return 0;
+}
+
+static int bench_warmup_timer(void *data) {
+    /* By now the clients have mapped their windows */
+    struct bench *bench = data;
+    bench_arrange_views(bench);
+    /* Attached only now, so that the bridge has to learn about the outputs
+     * and views which already exist when it shows up */
+    if (bench->options.layout) server_set_bridge(&bench->server, &bench_bridge_hooks);
+    bench_reset_stats(bench);
+    bench->measuring = true;
+    wl_event_source_timer_update(bench->input_timer, 1);
+    wl_event_source_timer_update(bench->end_timer, bench->options.duration * 1000);
+    return 0;
+}
+
+static double bench_repaint_avg(struct bench *bench) {
+    uint64_t count = 0;
+    int64_t total = 0;
+    struct kaiju_output *output;
+    wl_list_for_each(output, &bench->server.outputs, link) {
+        count += output->stats.render_time.count;
+        total += output->stats.render_time.total;
+    }
+    return count ? total / 1000.0 / count : 0.0;
+}
+
+static void bench_report(struct bench *bench) {
+    struct kaiju_server *server = &bench->server;
+    struct bench_options *options = &bench->options;
+    double seconds = options->duration;
+
+    printf("kaiju-bench: %d outputs, %d clients committing %dx%d at %d Hz%s, %.0f s, %s\n",
+           options->outputs, options->clients, options->width, options->height,
+           options->commit_rate, options->partial_damage ? " (partial damage)" : "", seconds,
+           server->render_batch.enabled ? "batched" : "unbatched");
+
+    struct kaiju_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        struct kaiju_output_stats *stats = &output->stats;
+        struct kaiju_histogram *render = &stats->render_time;
+        printf("%s: %llu frames (%.1f/s), %llu scanned out, %llu missed vblanks\n",
+               output->wlr_output->name, (unsigned long long) stats->frames, stats->frames / seconds,
+               (unsigned long long) stats->scanout_frames, (unsigned long long) stats->missed_vblanks);
+        printf("  repaint: avg %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us over %llu repaints\n",
+               render->count ? render->total / 1000.0 / render->count : 0.0,
+               histogram_percentile(render, 50) / 1000.0, histogram_percentile(render, 99) / 1000.0,
+               render->max / 1000.0, (unsigned long long) render->count);
+        uint64_t composited = stats->frames - stats->scanout_frames;
+        printf("  draws:   %.1f per composited frame, %llu of %llu frames batched\n",
+               composited ? (double) stats->draw_calls / composited : 0.0,
+               (unsigned long long) stats->batched_frames, (unsigned long long) composited);
+    }
+
+    printf("commits:  %llu (%.1f/s)\n", (unsigned long long) bench->commits, bench->commits / seconds);
+
+    uint64_t upload_bytes = 0;
+    struct kaiju_client *client;
+    wl_list_for_each(client, &server->clients, link) {
+        upload_bytes += client->upload_bytes;
+    }
+    printf("buffers:  %d dmabuf and %d shm clients, %.1f MiB uploaded (%.1f MiB/s)\n",
+           bench->dmabuf_clients, options->clients - bench->dmabuf_clients,
+           upload_bytes / 1048576.0, upload_bytes / 1048576.0 / seconds);
+
+    printf("input:    %llu events (%.1f/s), avg %.2f us per event, %.0f events/s sustainable\n",
+           (unsigned long long) bench->input_events, bench->input_events / seconds,
+           bench->input_events ? bench->input_time / 1000.0 / bench->input_events : 0.0,
+           bench->input_time ? bench->input_events * 1e9 / bench->input_time : 0.0);
+
+    if (options->layout) bench_check_layout(bench);
+    if (options->verbose) stats_write_json(server, stdout);
+
+    /* Hit-testing is measured separately at random points, since the cursor
+     * only covers a small part of the layout during the run. */
+    struct wlr_box *layout = wlr_output_layout_get_box(server->output_layout, NULL);
+    int hits = 0;
+    int64_t start = now_nsec();
+    for (int i = 0; i < BENCH_HIT_TESTS; i++) {
+        double lx = layout->x + rand() % layout->width;
+        double ly = layout->y + rand() % layout->height;
+        struct wlr_surface *surface = NULL;
+        double sx, sy;
+        if (desktop_view_at(server, lx, ly, &surface, &sx, &sy) != NULL) hits++;
+    }
+    int64_t hit_time = now_nsec() - start;
+    printf("hit-test: avg %.1f ns over %d lookups (%d hits)\n",
+           (double) hit_time / BENCH_HIT_TESTS, BENCH_HIT_TESTS, hits);
+}
+
+static int bench_end_timer(void *data) {
+    struct bench *bench = data;
+    struct kaiju_server *server = &bench->server;
+    bench->measuring = false;
+    bench_report(bench);
+
+    if (bench->options.compare && server->render_batch.enabled) {
+        /* Same clients and layout once more, only drawn surface by surface */
+        bench->batched_repaint = bench_repaint_avg(bench);
+        server->render_batch.enabled = false;
+        struct kaiju_output *output;
+        wl_list_for_each(output, &server->outputs, link) {
+            wlr_output_damage_add_whole(output->damage);
+        }
+        printf("\n");
+        bench_reset_stats(bench);
+        bench->measuring = true;
+        wl_event_source_timer_update(bench->end_timer, bench->options.duration * 1000);
+        return 0;
+    }
+    if (bench->options.compare) {
+        double unbatched = bench_repaint_avg(bench);
+        if (bench->batched_repaint > 0 && unbatched > 0) {
+            printf("\ncompare:  avg repaint %.1f us batched, %.1f us unbatched (%.2fx)\n",
+                   bench->batched_repaint, unbatched, unbatched / bench->batched_repaint);
+        } else {
+            printf("\ncompare:  the renderer can't batch, nothing to compare\n");
+        }
+    }
+    wl_display_terminate(server->wl_display);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options]\n"
+                    "  -o, --outputs N       headless outputs (default 1)\n"
+                    "  -c, --clients N       clients (default 8)\n"
+                    "  -r, --rate HZ         commits per second per client (default 60)\n"
+                    "  -i, --input-rate HZ   synthetic input events per second (default 1000)\n"
+                    "  -d, --duration S      seconds to measure (default 5)\n"
+                    "  -s, --size WxH        client buffer size (default 640x480)\n"
+                    "  -p, --partial         only damage part of each buffer\n"
+                    "  -b, --dmabuf          share buffers as udmabuf backed dmabufs\n"
+                    "  -u, --unbatched       draw surfaces one by one instead of batched\n"
+                    "  -C, --compare         measure batched, then again unbatched\n"
+                    "  -l, --layout          attach a columns layout and check it is applied\n"
+                    "  -v, --verbose         also print all statistics as JSON\n", name);
+}
+
+static bool parse_options(int argc, char **argv, struct bench_options *options) {
+    *options = (struct bench_options) {
+            .outputs = 1,
+            .clients = 8,
+            .commit_rate = 60,
+            .input_rate = 1000,
+            .duration = 5,
+            .width = 640,
+            .height = 480,
+    };
+    static const struct option long_options[] = {
+            {"outputs", required_argument, NULL, 'o'},
+            {"clients", required_argument, NULL, 'c'},
+            {"rate", required_argument, NULL, 'r'},
+            {"input-rate", required_argument, NULL, 'i'},
+            {"duration", required_argument, NULL, 'd'},
+            {"size", required_argument, NULL, 's'},
+            {"partial", no_argument, NULL, 'p'},
+            {"dmabuf", no_argument, NULL, 'b'},
+            {"unbatched", no_argument, NULL, 'u'},
+            {"compare", no_argument, NULL, 'C'},
+            {"layout", no_argument, NULL, 'l'},
+            {"verbose", no_argument, NULL, 'v'},
+            {"help", no_argument, NULL, 'h'},
+            {0},
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "o:c:r:i:d:s:pbuClvh", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'o': options->outputs = atoi(optarg); break;
+            case 'c': options->clients = atoi(optarg); break;
+            case 'r': options->commit_rate = atoi(optarg); break;
+            case 'i': options->input_rate = atoi(optarg); break;
+            case 'd': options->duration = atoi(optarg); break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &options->width, &options->height) != 2) return false;
+                break;
+            case 'p': options->partial_damage = true; break;
+            case 'b': options->dmabuf = true; break;
+            case 'u': options->unbatched = true; break;
+            case 'C': options->compare = true; break;
+            case 'l': options->layout = true; break;
+            case 'v': options->verbose = true; break;
+            default: return false;
+        }
+    }
+    return options->outputs > 0 && options->clients >= 0 && options->commit_rate > 0 &&
+           options->input_rate > 0 && options->duration > 0 &&
+           options->width > 0 && options->height > 0 && !(options->unbatched && options->compare);
+}
+
+int main(int argc, char **argv) {
+    struct bench bench = {0};
+    wl_array_init(&bench_bridge.placed);
+    if (!parse_options(argc, argv, &bench.options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct wl_display *display = wl_display_create();
+    assert(display);
+    struct wlr_backend *backend = wlr_headless_backend_create(display, NULL);
+    assert(backend);
+    server_init(&bench.server, display, backend);
+    /* The batch is used unless KAIJU_RENDER_BATCH says otherwise */
+    if (bench.options.unbatched) bench.server.render_batch.enabled = false;
+
+    for (int i = 0; i < bench.options.outputs; i++) {
+        wlr_headless_add_output(backend, 1920, 1080);
+    }
+    bench.pointer = wlr_headless_add_input_device(backend, WLR_INPUT_DEVICE_POINTER);
+    bench.keyboard = wlr_headless_add_input_device(backend, WLR_INPUT_DEVICE_KEYBOARD);
+
+    if (!wlr_backend_start(backend)) {
+        fprintf(stderr, "Failed to start headless backend\n");
+        wl_display_destroy(display);
+        return 1;
+    }
+
+    struct wl_event_loop *loop = bench.server.wl_event_loop;
+    bench.warmup_timer = wl_event_loop_add_timer(loop, bench_warmup_timer, &bench);
+    bench.input_timer = wl_event_loop_add_timer(loop, bench_input_timer, &bench);
+    bench.end_timer = wl_event_loop_add_timer(loop, bench_end_timer, &bench);
+
+    bench.clients = calloc(bench.options.clients, sizeof(struct bench_client *));
+    for (int i = 0; i < bench.options.clients; i++) {
+        bench.clients[i] = bench_client_create(&bench, i);
+    }
+    wl_event_source_timer_update(bench.warmup_timer, BENCH_WARMUP_MS);
+
+    wl_display_run(display);
+
+    wl_event_source_remove(bench.warmup_timer);
+    wl_event_source_remove(bench.input_timer);
+    wl_event_source_remove(bench.end_timer);
+    for (int i = 0; i < bench.options.clients; i++) {
+        bench_client_destroy(bench.clients[i]);
+    }
+    free(bench.clients);
+    server_finish(&bench.server);
+    wl_array_release(&bench_bridge.placed);
+    return bench.failed ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+
+/* Events are handed to the bridge through a single-producer/single-consumer
+ * ring of fixed size records in shared memory, instead of one call into
+ * Kotlin per event. The compositor appends records and advances head, the
+ * bridge consumes them in batches from its onEvents hook and advances tail.
+ * Both indices only ever grow and wrap around at 2^32, the slot of an index
+ * is index & (capacity - 1). */
+
+enum bridge_event_type {
+    BRIDGE_EVENT_KEY = 1,
+    BRIDGE_EVENT_POINTER_MOTION,
+    BRIDGE_EVENT_POINTER_BUTTON,
+    BRIDGE_EVENT_VIEW_MAP,
+    BRIDGE_EVENT_VIEW_UNMAP,
+    BRIDGE_EVENT_OUTPUT_ADD,
+    BRIDGE_EVENT_OUTPUT_REMOVE,
+};
+
+struct bridge_key_event {
+    uint32_t keycode;
+    uint32_t state;
+    uint32_t modifiers;
+    /** First keysym of the key with the current layout and modifiers */
+    uint32_t keysym;
+};
+
+struct bridge_motion_event {
+    /** Cursor position in layout coordinates */
+    double x, y;
+};
+
+struct bridge_button_event {
+    uint32_t button;
+    uint32_t state;
+};
+
+struct bridge_view_event {
+    uint32_t id;
+    int32_t x, y, width, height;
+};
+
+struct bridge_output_event {
+    uint32_t id;
+    int32_t width, height;
+    /** In mHz, 0 if unknown */
+    int32_t refresh;
+};
+
+/* 32 bytes, so that two records fit a cache line */
+struct bridge_event {
+    uint32_t type;
+    uint32_t time_msec;
+    union {
+        struct bridge_key_event key;
+        struct bridge_motion_event motion;
+        struct bridge_button_event button;
+        struct bridge_view_event view;
+        struct bridge_output_event output;
+    } data;
+};
+
+struct bridge_event_ring {
+    /** Number of records, a power of two */
+    uint32_t capacity;
+    /** Offset of the first record from the start of the ring */
+    uint32_t events_offset;
+
+    /* Written by the compositor only. head is published with release
+     * semantics after the record it covers has been written. */
+    uint32_t head;
+    /** Records which did not fit and were thrown away */
+    uint64_t dropped;
+    /** Times the compositor had to drain the ring on the spot to make room */
+    uint64_t stalls;
+    uint64_t produced;
+
+    /* Written by the bridge only, on its own cache line */
+    uint8_t padding[64 - 4 * sizeof(uint32_t) - 3 * sizeof(uint64_t)];
+    uint32_t tail;
+};
@@ -1,5 +1,34 @@
 #pragma once
+#include <stdbool.h>
+#include "./events.h"
+#include "./keybindings.h"
+#include "./view.h"
 
+/* Returned by kaijuEntry. Both kaijuEntry and the hooks are called from the
+ * compositor's event loop, on the thread that runs it. */
 struct bridge_hooks {
     void* (*onUnload)(void);
+    /** Consumes the records between tail and head of the ring, and advances
+     * tail past them. Called from the compositor's event loop. */
+    void (*onEvents)(struct bridge_event_ring *ring);
+
+    /** Bindings to compile into the compositor's lookup table. Read once
+     * after the bridge is loaded, changes after that have no effect. */
+    struct bridge_keybinding *keybindings;
+    uint32_t keybinding_count;
+    /** Called when a key press matches the binding with the given id */
+    void (*onKeybinding)(uint32_t id);
+
+    /** Lays out all mapped views at once, topmost first. The bridge changes
+     * the entries in place without reordering them, and the compositor
+     * applies all changes together once this returns. Called whenever views
+     * or outputs come and go. */
+    void (*onLayout)(struct view_props *views, uint32_t count);
+
+    /** Serializes the bridge's state before it is replaced by a live reload.
+     * Returns the size of the state, which may be larger than capacity, in
+     * which case it is called again with a large enough buffer. */
+    uint32_t (*onSnapshot)(void *buffer, uint32_t capacity);
+    /** Called on a freshly loaded bridge with the state of the one it replaces */
+    void (*onRestore)(const void *data, uint32_t size);
 };
@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+
+/* A key combination the bridge wants to handle itself. Matching key presses
+ * are not sent to clients, and the bridge is called with the binding's id. */
+struct bridge_keybinding {
+    /** Mask of WLR_MODIFIER_* which must be held, locks are ignored */
+    uint32_t modifiers;
+    /** Keysym as produced by the keymap. Letters match regardless of case,
+     * so use the shift modifier to tell them apart. */
+    uint32_t keysym;
+    uint32_t id;
+};
@@ -1,5 +1,20 @@
 #pragma once
+#include <stdint.h>
+
+enum view_flags {
+    /** The view has keyboard focus. Setting it focuses and raises the view. */
+    VIEW_FLAG_FOCUSED = 1 << 0,
+    /** The view covers its output. Can be set and cleared by the bridge. */
+    VIEW_FLAG_FULLSCREEN = 1 << 1,
+};
 
 struct view_props {
+    uint32_t id;
+    /** Position of the view's surface in layout coordinates */
     int x, y;
-};
\ No newline at end of file
+    /** Size of the window geometry. Changing it asks the client to resize,
+     * and the view only moves once the client caught up. */
+    int width, height;
+    /** Mask of enum view_flags */
+    uint32_t flags;
+};
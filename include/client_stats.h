@@ -0,0 +1,52 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <wayland-server-core.h>
+
+struct kaiju_server;
+
+/* Per client accounting of the pixels shm clients make us upload to the GPU.
+ * wlroots uploads only the damaged rectangles of an shm buffer as long as it
+ * can keep the surface's texture, i.e. while the buffer keeps its size and
+ * format, and imports the whole buffer into a new texture otherwise. */
+struct kaiju_client {
+    struct wl_list link; // kaiju_server::clients
+    struct wl_client *client;
+    struct wl_listener destroy;
+    pid_t pid;
+    struct wl_list surfaces; // kaiju_surface_upload::link
+    /** Bytes uploaded in total */
+    uint64_t upload_bytes;
+    /** Commits which updated an existing texture, and ones which needed a new texture */
+    uint64_t partial_uploads, full_uploads;
+    /** Full uploads of a buffer with the same size and format as the one before */
+    uint64_t texture_reuse_misses;
+    /** Commits of a new dmabuf, which needed no upload at all */
+    uint64_t dmabuf_commits;
+    /** Bytes uploaded since window_start, and the rate over the last full window */
+    int64_t window_start;
+    uint64_t window_bytes;
+    double upload_rate;
+};
+
+/* Remembers what a surface last uploaded, to tell partial and full uploads apart */
+struct kaiju_surface_upload {
+    struct wl_list link;
+    struct kaiju_server *server;
+    struct wlr_surface *surface;
+    /** NULL once the client is gone, its surfaces are destroyed right after */
+    struct kaiju_client *client;
+    struct wl_listener commit;
+    struct wl_listener destroy;
+    struct wlr_texture *texture;
+    int32_t width, height;
+    uint32_t format;
+};
+
+void client_stats_init(struct kaiju_server *server);
+void client_stats_finish(struct kaiju_server *server);
+void client_stats_reset(struct kaiju_server *server);
+/** Writes the clients as a JSON array */
+void client_stats_write_json(struct kaiju_server *server, FILE *file);
@@ -1,3 +1,15 @@
 #pragma once
 
-void config_load();
\ No newline at end of file
+struct kaiju_server;
+
+/** Hooks of the loaded bridge, NULL until it has finished loading */
+extern struct bridge_hooks *bridge_hooks;
+
+/** Starts loading the bridge in the background. It is attached to the
+ * server from the event loop once it is ready. */
+void config_load(struct kaiju_server *server);
+void config_unload();
+/** Reloads the bridge whenever its library changes on disk */
+void config_watch(struct kaiju_server *server);
+/** Stops loading and watching the bridge */
+void config_unwatch();
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <wayland-server-core.h>
+#include "./bridge/events.h"
+
+#define KAIJU_EVENT_RING_CAPACITY 4096
+
+struct bridge_hooks;
+
+/* Producer side of the event ring shared with the bridge. Records are
+ * appended as events happen and the bridge is asked to drain them once per
+ * event loop iteration, so a burst of input costs a single call into
+ * Kotlin. */
+struct kaiju_event_ring {
+    struct bridge_event_ring *shared;
+    size_t size;
+    int fd;
+    struct wl_event_loop *loop;
+    /** Pending drain, scheduled by the first record after the last drain */
+    struct wl_event_source *drain_idle;
+    /** The bridge which consumes the records, NULL to discard them */
+    struct bridge_hooks *hooks;
+};
+
+bool event_ring_init(struct kaiju_event_ring *ring, struct wl_event_loop *loop, uint32_t capacity);
+void event_ring_finish(struct kaiju_event_ring *ring);
+/** Appends a record. When the ring is full, droppable records such as
+ * pointer motion are thrown away, while any other record first makes the
+ * bridge drain the ring right away. */
+void event_ring_push(struct kaiju_event_ring *ring, const struct bridge_event *event, bool droppable);
+/** Hands all pending records to the bridge */
+void event_ring_drain(struct kaiju_event_ring *ring);
@@ -11,3 +11,10 @@ struct kaiju_keyboard {
 };
 
 void configure_input(struct kaiju_server *server);
+/** Sets the current cursor image again, e.g. for an output which was just
+ * added */
+void cursor_refresh_image(struct kaiju_server *server);
+/** Finds the topmost view and surface under a point in layout coordinates */
+struct kaiju_view *desktop_view_at(
+        struct kaiju_server *server, double lx, double ly,
+        struct wlr_surface **surface, double *sx, double *sy);
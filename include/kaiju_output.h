@@ -1,14 +1,50 @@
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <wayland-util.h>
+#include <wlr/types/wlr_box.h>
+#include "./scene.h"
+#include "./stats.h"
+
+#define KAIJU_RENDER_TIME_AUTO -1
 
 struct kaiju_output {
     struct wlr_output *wlr_output;
     struct kaiju_server *server;
+    /** Identifies the output towards the bridge */
+    uint32_t id;
+    /** When the last frame was presented, or the output was created */
     struct timespec last_frame;
+    /** Accumulates the regions of the output which need to be repainted */
+    struct wlr_output_damage *damage;
+    /** Whether the last frame was a client buffer scanned out directly */
+    bool scanned_out;
+    /** Whether the cursor is on a hardware plane, rather than drawn by us */
+    bool hardware_cursor;
+
+    /** Mapped views which intersect the output, topmost first. Rebuilt on
+     * the next frame after views_serial fell behind the view index or the
+     * output moved away from views_box. */
+    struct wl_array views; // struct kaiju_view *
+    uint64_t views_serial;
+    struct wlr_box views_box;
+    /** What the views on the output look like on it, see scene.h */
+    struct kaiju_scene scene;
+
+    /** Time budget for rendering a frame in milliseconds. Rendering is delayed
+     * until that long before the next vblank. 0 renders as soon as the frame
+     * event arrives, KAIJU_RENDER_TIME_AUTO derives the budget from
+     * render_time. */
+    int max_render_time;
+    /** Decaying peak of recent render times, in nanoseconds */
+    int64_t render_time;
+    struct wl_event_source *repaint_timer;
+    struct kaiju_output_stats stats;
 
     struct wl_listener destroy;
     struct wl_listener frame;
+    struct wl_listener present;
 
     struct wl_list link;
-};
\ No newline at end of file
+};
@@ -3,6 +3,15 @@
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/types/wlr_seat.h>
 #include <wlr/backend.h>
+#include "./client_stats.h"
+#include "./event_ring.h"
+#include "./keybindings.h"
+#include "./pool.h"
+#include "./render_batch.h"
+#include "./shell/layout.h"
+#include "./shell/transaction.h"
+#include "./shell/view_index.h"
+#include "./stats.h"
 
 enum kaiju_cursor_mode {
     KAIJU_CURSOR_PASSTHROUGH,
@@ -29,6 +38,24 @@ struct kaiju_server {
     struct wl_listener cursor_button;
     struct wl_listener cursor_axis;
     struct wl_listener cursor_frame;
+    /** Name of the xcursor image being shown, NULL while a client's surface
+     * is. Owned by the server, callers may pass any string. */
+    char *cursor_image;
+    /** Client surface being shown as the cursor, with its hotspot */
+    struct wlr_surface *cursor_surface;
+    int32_t cursor_hotspot_x, cursor_hotspot_y;
+    struct wl_listener cursor_surface_destroy;
+    /** Cursor images set, and redundant ones skipped */
+    uint64_t cursor_image_sets, cursor_image_skips;
+    /** Sends unaccelerated motion deltas to clients which ask for them */
+    struct wlr_relative_pointer_manager_v1 *relative_pointer_manager;
+    /** Defer hit-testing and focus updates to the next pointer frame */
+    bool coalesce_motion;
+    /** Whether the cursor moved since the last processed motion */
+    bool motion_pending;
+    uint32_t motion_pending_time;
+    /** Time from the device timestamp to the seat notification */
+    struct kaiju_histogram input_latency;
 
     // *** Grabbing ***
     enum kaiju_cursor_mode cursor_mode;
@@ -42,10 +69,64 @@ struct kaiju_server {
     struct wlr_backend *backend;
     /** Global which clients can add surfaces to */
     struct wlr_compositor *compositor;
+    struct wl_listener new_surface;
+    /** Clients with surfaces, for their upload statistics */
+    struct wl_list clients; // kaiju_client::link
     struct wlr_renderer *renderer;
+    /** Draws the surfaces of a frame in as few GL calls as possible */
+    struct kaiju_render_batch render_batch;
+    /** Lets clients share GPU buffers with us instead of copying through shm */
+    struct wlr_linux_dmabuf_v1 *linux_dmabuf;
+    /** Tells clients when exactly their content was shown on screen */
+    struct wlr_presentation *presentation;
     struct wl_list outputs; // kaiju_output::link
     struct wlr_output_layout *output_layout;
     struct wl_listener new_output;
     struct wl_listener new_xdg_surface;
     struct wl_list views;
+    /** Speeds up finding the view under the cursor */
+    struct view_index view_index;
+    /** Paces frame callbacks of hidden views, every frame_throttle_interval
+     * milliseconds. NULL if they get none at all. */
+    struct wl_event_source *frame_throttle_timer;
+    int frame_throttle_interval;
+    /** Last scene serial handed out to a view */
+    uint64_t scene_serial;
+    /** Last stack_order handed out to a view */
+    uint64_t stack_counter;
+    /** Last ids handed out to a view and an output */
+    uint32_t last_view_id, last_output_id;
+
+    // *** Bridge ***
+    /** Hooks of the loaded bridge, or NULL when running without one */
+    struct bridge_hooks *bridge;
+    /** Passes input and window management events on to the bridge */
+    struct kaiju_event_ring event_ring;
+    /** Keybindings registered by the bridge */
+    struct kaiju_keybindings keybindings;
+    /** Pending layout pass of the bridge */
+    struct kaiju_layout layout;
+    /** Layout change waiting for clients to resize */
+    struct kaiju_transaction transaction;
+
+    // *** Allocation ***
+    struct kaiju_pool view_pool;
+    struct kaiju_pool popup_pool;
+    struct kaiju_pool subsurface_pool;
+    struct kaiju_pool output_pool;
+    struct kaiju_pool surface_pool;
+
+    // *** Instrumentation ***
+    struct wl_event_source *stats_signal;
+    /** When the process started, for the startup breakdown. 0 to skip it. */
+    int64_t startup_time;
+    bool first_frame_shown;
 };
+
+/** Sets up the server and all of its globals on top of the given backend.
+ * The backend still has to be started by the caller. */
+void server_init(struct kaiju_server *server, struct wl_display *display, struct wlr_backend *backend);
+/** Hooks the server up to a bridge, or unhooks it when NULL */
+void server_set_bridge(struct kaiju_server *server, struct bridge_hooks *hooks);
+/** Disconnects all clients and tears the server down, display included */
+void server_finish(struct kaiju_server *server);
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+#include "./bridge/keybindings.h"
+
+struct kaiju_keybinding {
+    uint32_t modifiers;
+    xkb_keysym_t keysym;
+    uint32_t id;
+    bool used;
+};
+
+/* Open addressing hash table of keybindings, keyed by modifier mask and
+ * keysym. It is kept at most half full, so that a key press which matches
+ * no binding usually costs a single probe, no matter how many bindings
+ * there are. */
+struct kaiju_keybindings {
+    struct kaiju_keybinding *slots;
+    /** Number of slots, a power of two, or 0 while empty */
+    size_t capacity;
+    size_t count;
+};
+
+void keybindings_init(struct kaiju_keybindings *bindings);
+void keybindings_finish(struct kaiju_keybindings *bindings);
+/** Replaces all bindings with the given ones */
+void keybindings_compile(struct kaiju_keybindings *bindings,
+                         const struct bridge_keybinding *list, size_t count);
+/** Returns the binding for a key press, or NULL if there is none */
+const struct kaiju_keybinding *keybindings_find(const struct kaiju_keybindings *bindings,
+                                                uint32_t modifiers, xkb_keysym_t keysym);
@@ -1,4 +1,25 @@
 #pragma once
+#include <stdbool.h>
 #include <wayland-server-core.h>
+#include "./bridge/events.h"
+
+struct kaiju_output;
+struct kaiju_server;
+struct wlr_surface;
+struct wlr_box;
+
 void output_destroy_notify(struct wl_listener *listener, void *data);
 void new_output_notify(struct wl_listener *listener, void *data);
+/** Tells the bridge about a change to the output, through the event ring */
+void output_push_event(struct kaiju_output *output, enum bridge_event_type type);
+
+/** Damages a surface whose top-left corner is at lx, ly in layout coordinates.
+ * Unless whole is set, only the damage the surface committed is added. */
+void output_damage_surface(struct kaiju_output *output, struct wlr_surface *surface,
+                           double lx, double ly, bool whole);
+/** Damages a box given in layout coordinates on every output it touches */
+void server_damage_box(struct kaiju_server *server, struct wlr_box *box);
+/** Sends frame callbacks to views which are hidden behind opaque views or
+ * offscreen at a low rate, set through KAIJU_HIDDEN_FRAME_RATE */
+void frame_throttle_init(struct kaiju_server *server);
+void frame_throttle_finish(struct kaiju_server *server);
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define KAIJU_POOL_SLAB_OBJECTS 64
+
+struct kaiju_pool_slab;
+
+struct kaiju_pool_stats {
+    /** Objects handed out in total */
+    uint64_t allocations;
+    /** Allocations served from a previously freed slot */
+    uint64_t reuses;
+    uint64_t frees;
+    size_t live, peak;
+    /** Slots across all slabs */
+    size_t capacity;
+};
+
+/* Fixed size object allocator for objects which come and go a lot, such as
+ * views and popups. Objects are carved out of slabs which are never moved or
+ * returned to the system while the pool lives, so their addresses stay valid
+ * and freed slots are reused before new slabs are allocated.
+ *
+ * With KAIJU_POOL_DEBUG=1 in the environment, freed slots are filled with a
+ * poison pattern which is verified when the slot is handed out again. This
+ * catches writes through dangling pointers, e.g. from listeners which weren't
+ * removed when their object was freed. */
+struct kaiju_pool {
+    const char *name;
+    size_t object_size;
+    struct kaiju_pool_slab *slabs;
+    /** Freed slots, linked through their first bytes */
+    void *free_list;
+    /** Slots of the newest slab which were never handed out */
+    char *fresh;
+    size_t fresh_left;
+    bool poison;
+    struct kaiju_pool_stats stats;
+};
+
+void pool_init(struct kaiju_pool *pool, const char *name, size_t object_size);
+void pool_finish(struct kaiju_pool *pool);
+/** Returns a zeroed object */
+void *pool_alloc(struct kaiju_pool *pool);
+void pool_free(struct kaiju_pool *pool, void *object);
+void pool_print_stats(struct kaiju_pool *pool, FILE *file);
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pixman.h>
+#include <wayland-util.h>
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_output.h>
+
+#define KAIJU_BATCH_SHADERS 3
+
+struct wlr_renderer;
+struct wlr_texture;
+
+struct kaiju_batch_shader {
+    /** 0 if the shader is not available, e.g. for lack of an extension */
+    unsigned int program;
+    int proj, tex;
+};
+
+/* Collects the textured quads of a frame and draws them with as few GL calls
+ * as possible, instead of one scissored wlr_render_texture_with_matrix call
+ * per damaged rectangle of every surface. Quads are clipped to the damage on
+ * the CPU, all vertices go up in a single buffer upload, and consecutive
+ * quads of the same texture become a single draw. The drawing order is kept,
+ * so blending works out the same as before.
+ *
+ * Only GLES2 textures without a buffer transform are batched. Everything else
+ * is drawn by wlroots, after flushing what was batched so far. */
+struct kaiju_render_batch {
+    /** Whether to batch at all, KAIJU_RENDER_BATCH=0 turns it off */
+    bool enabled;
+    /** Shaders are compiled on first use, in the renderer's context */
+    bool initialized;
+    struct wlr_renderer *renderer;
+    struct kaiju_batch_shader shaders[KAIJU_BATCH_SHADERS];
+    unsigned int vbo;
+    /** Projection for the output being drawn, transposed for GL */
+    float projection[9];
+    struct wl_array vertices; // float x, y, u, v
+    struct wl_array draws; // struct batch_draw
+};
+
+void render_batch_init(struct kaiju_render_batch *batch);
+void render_batch_finish(struct kaiju_render_batch *batch);
+/** Gets the batch ready for a frame of the output. Returns false if frames
+ * have to be drawn without it. */
+bool render_batch_begin(struct kaiju_render_batch *batch, struct wlr_renderer *renderer,
+                        struct wlr_output *output);
+/** Adds the given region of a texture drawn at box, both in output buffer
+ * coordinates. Returns false if the texture can't be batched. */
+bool render_batch_add(struct kaiju_render_batch *batch, struct wlr_texture *texture,
+                      const struct wlr_box *box, enum wl_output_transform transform,
+                      pixman_region32_t *region);
+/** Draws everything added so far. Returns the number of draw calls. */
+unsigned int render_batch_flush(struct kaiju_render_batch *batch);
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-util.h>
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_output.h>
+
+struct kaiju_output;
+struct kaiju_view;
+struct wlr_surface;
+
+/* A surface as it is drawn on one output */
+struct kaiju_scene_node {
+    struct wlr_surface *surface;
+    /** Where the surface goes, in output buffer coordinates */
+    struct wlr_box box;
+    /** Projection of box, ready to render the surface's texture with */
+    float matrix[9];
+};
+
+/* The nodes of one view. They stay valid as long as the view keeps its
+ * scene serial and position. */
+struct kaiju_scene_view {
+    struct kaiju_view *view;
+    uint64_t serial;
+    int x, y;
+    /** Range of the view's nodes in kaiju_scene::nodes, from bottom to top */
+    size_t first, count;
+};
+
+/* Retained render list of an output: the surfaces of all views on it, with
+ * their boxes and matrices worked out. Only views which committed, moved or
+ * had surfaces come and go since the last frame are walked again, and
+ * nothing is recomputed while everything stays put. */
+struct kaiju_scene {
+    struct wl_array views; // struct kaiju_scene_view, bottom to top
+    struct wl_array nodes; // struct kaiju_scene_node
+    /** Last frame's arrays, kept around to reuse their allocations */
+    struct wl_array old_views, old_nodes;
+
+    /** Output state the nodes were computed for */
+    struct wlr_box output_box;
+    float scale;
+    enum wl_output_transform transform;
+    int width, height;
+};
+
+void scene_init(struct kaiju_scene *scene);
+void scene_finish(struct kaiju_scene *scene);
+/** Brings the scene of an output up to date, given the views on it with the
+ * topmost first */
+void scene_update(struct kaiju_output *output, struct kaiju_view **views, size_t count);
@@ -1,7 +1,9 @@
 #pragma once
 #include <stdlib.h>
+#include <pixman.h>
 #include <wayland-util.h>
 #include <wayland-server-core.h>
+#include <wlr/types/wlr_box.h>
 #include <bridge/view.h>
 
 struct kaiju_view {
@@ -11,10 +13,97 @@ struct kaiju_view {
 	struct wl_listener map;
 	struct wl_listener unmap;
 	struct wl_listener destroy;
+	struct wl_listener commit;
 	struct wl_listener request_move;
 	struct wl_listener request_resize;
+	struct wl_listener request_fullscreen;
+	struct wl_listener new_subsurface;
 	bool mapped;
+	/* Only the id and position are kept up to date here, the rest is filled
+	 * in when the props are handed to the bridge */
 	struct view_props props;
+	/* Size of the toplevel surface as of the last commit. Kept around so
+	 * that we can still damage the area after the surface unmaps. */
+	int width, height;
+	/* Part of the view left uncovered by opaque views above it, in buffer
+	 * coordinates of the output currently being rendered. Only valid during
+	 * that output's frame. */
+	pixman_region32_t visible;
+	/* Whether nothing of the view showed the last time its primary output was
+	 * repainted. Hidden views only get throttled frame callbacks. */
+	bool occluded;
+	/* Where the view was before it went fullscreen, in layout coordinates */
+	struct wlr_box saved_geometry;
+	/* Fullscreen was asked for before the view was mapped */
+	bool fullscreen_requested;
+	/* Position in the stack, higher values are closer to the top */
+	uint64_t stack_order;
+	/* Bounds the view was last entered into the view index with */
+	struct wlr_box index_box;
+	bool indexed;
+	/* Interactive resizes keep at most one configure in flight. The serial
+	 * of that configure is kept here, or 0 if there is none. */
+	uint32_t resize_serial;
+	/* Position and size the outstanding configure was sent for */
+	struct wlr_box resize_sent;
+	/* Latest position and size asked for, sent once the client caught up */
+	struct wlr_box resize_wanted;
+	bool resize_queued;
+	uint32_t resize_edges;
+	/* Layout transaction the view is part of, see transaction.h */
+	struct wl_list transaction_link;
+	struct wlr_box transaction_geometry;
+	uint32_t transaction_serial;
+	bool transaction_waiting;
+	/* Changes whenever any of the view's surfaces committed, or one came or
+	 * went, which makes outputs compute its scene nodes again */
+	uint64_t scene_serial;
+	struct wl_list subsurfaces; // kaiju_subsurface::link
+};
+
+/* Popups are owned by the view of their toplevel and are only tracked so
+ * that their commits can be damaged. */
+struct kaiju_popup {
+	struct kaiju_view *view;
+	struct wlr_xdg_surface *xdg_surface;
+	struct wl_listener map;
+	struct wl_listener unmap;
+	struct wl_listener destroy;
+	struct wl_listener commit;
+	struct wl_listener new_subsurface;
+	/* Last known position and size in layout coordinates */
+	struct wlr_box box;
+};
+
+/* Subsurfaces are tracked for the same reason, and so that a view's scene
+ * nodes never outlive its surfaces. Subsurfaces of subsurfaces are tracked
+ * as well. */
+struct kaiju_subsurface {
+	struct wl_list link;
+	struct kaiju_server *server;
+	/* NULL once the view is gone while the subsurface is still around */
+	struct kaiju_view *view;
+	struct wlr_subsurface *wlr_subsurface;
+	struct wl_listener destroy;
+	struct wl_listener commit;
+	struct wl_listener new_subsurface;
 };
 
 void focus_view(struct kaiju_view *view, struct wlr_surface *surface);
+/** Damages every surface of the view. Unless whole is set, only the damage
+ * committed by the surfaces is added. */
+void view_damage(struct kaiju_view *view, bool whole);
+/** Asks the client to resize the view. geometry is the new window geometry
+ * in layout coordinates, edges are the ones being dragged. */
+void view_resize(struct kaiju_view *view, struct wlr_box *geometry, uint32_t edges);
+/** Checks whether the client just committed the size of the outstanding
+ * resize configure and if so, moves the view to match and sends the next
+ * one. Returns whether the view was moved. */
+bool view_commit_resize(struct kaiju_view *view);
+/** Makes the view cover the whole output, or restores its previous position.
+ * If output is NULL, the output the view is mostly on is used. */
+void view_set_fullscreen(struct kaiju_view *view, bool fullscreen, struct wlr_output *output);
+/** Makes outputs compute the scene nodes of the view again */
+void view_invalidate_scene(struct kaiju_view *view);
+/** Finds the position of one of the view's surfaces relative to the view */
+bool view_surface_coords(struct kaiju_view *view, struct wlr_surface *surface, int *sx, int *sy);
@@ -0,0 +1,19 @@
+#pragma once
+#include <wayland-util.h>
+
+struct kaiju_server;
+
+/* Lets the bridge place all views in one go. Layout passes are requested
+ * whenever something changes and run once per event loop iteration, so a
+ * burst of windows mapping at the same time costs a single pass. */
+struct kaiju_layout {
+    struct wl_event_source *idle;
+    /** Reused between passes, so that a pass does not allocate */
+    struct wl_array props; // struct view_props
+    struct wl_array views; // struct kaiju_view *
+};
+
+void layout_init(struct kaiju_layout *layout);
+void layout_finish(struct kaiju_layout *layout);
+/** Requests a layout pass before the next frame */
+void layout_schedule(struct kaiju_server *server);
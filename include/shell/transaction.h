@@ -0,0 +1,44 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-util.h>
+#include <wlr/types/wlr_box.h>
+
+#define KAIJU_TRANSACTION_TIMEOUT_MS 200
+
+struct kaiju_server;
+struct kaiju_view;
+
+/* Changes the geometry of several views as a single step. Every view is sent
+ * its configure right away, but repaints of the outputs those views are on
+ * or move to are held back until all of the clients have committed buffers
+ * of their new size, and only then do the views move. The whole layout change thus shows up in one frame,
+ * instead of trickling in as clients catch up one by one. A client which
+ * does not respond within the timeout is left behind. */
+struct kaiju_transaction {
+    struct wl_list views; // kaiju_view::transaction_link
+    /** Views which still have to commit their new size */
+    size_t waiting;
+    bool active;
+    struct wl_event_source *timeout;
+    int timeout_ms;
+    /** Layout passes requested while active, run once it is over */
+    bool layout_deferred;
+};
+
+void transaction_init(struct kaiju_server *server);
+void transaction_finish(struct kaiju_server *server);
+/** Adds a view to the next transaction. geometry holds the new position of
+ * the view's surface and the new size of its window geometry. */
+void transaction_add(struct kaiju_view *view, const struct wlr_box *geometry);
+/** Starts waiting for the views added since the last transaction */
+void transaction_start(struct kaiju_server *server);
+/** Whether a transaction is waiting for its views */
+bool transaction_active(struct kaiju_server *server);
+/** Whether repaints of the given box in layout coordinates are held back,
+ * because a view of the active transaction is or will be there */
+bool transaction_holds_box(struct kaiju_server *server, const struct wlr_box *box);
+/** Checks whether a commit of the view completes its part of the transaction */
+void transaction_view_commit(struct kaiju_view *view);
+/** Drops a view which unmapped or went away from the transaction */
+void transaction_remove_view(struct kaiju_view *view);
@@ -0,0 +1,38 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-util.h>
+
+#define VIEW_INDEX_CELL_SIZE 256
+#define VIEW_INDEX_BUCKETS 256
+
+struct kaiju_view;
+
+/* A cell of the grid, holding every view whose bounds touch it. The views
+ * are kept sorted from top to bottom. */
+struct view_index_cell {
+    int x, y;
+    struct wl_array views; // struct kaiju_view *
+    struct view_index_cell *next;
+};
+
+/* Uniform grid over layout coordinates, used to find the views under a point
+ * without testing every single view. Only non-empty cells are allocated, and
+ * they are looked up through a small hash table. */
+struct view_index {
+    struct view_index_cell *buckets[VIEW_INDEX_BUCKETS];
+    /** Bumped whenever a view enters, moves within or leaves the index, so
+     * that anything derived from view bounds can tell when it is stale */
+    uint64_t serial;
+};
+
+void view_index_init(struct view_index *index);
+void view_index_finish(struct view_index *index);
+/** Re-indexes a view after it was mapped, moved, resized or restacked */
+void view_index_update(struct view_index *index, struct kaiju_view *view);
+/** Re-indexes a view only if the bounds of its surfaces changed, e.g. after a
+ * subsurface grew past the toplevel */
+void view_index_refresh(struct view_index *index, struct kaiju_view *view);
+void view_index_remove(struct view_index *index, struct kaiju_view *view);
+/** Returns the views whose bounds might contain the point, topmost first */
+struct kaiju_view **view_index_candidates(struct view_index *index, double lx, double ly, size_t *count);
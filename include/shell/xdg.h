@@ -1,3 +1,9 @@
 #pragma once
 #include <wayland-server-core.h>
-void server_new_xdg_surface(struct wl_listener *listener, void *data);
\ No newline at end of file
+#include "../bridge/events.h"
+
+struct kaiju_view;
+
+void server_new_xdg_surface(struct wl_listener *listener, void *data);
+/** Tells the bridge about a change to the view, through the event ring */
+void view_push_event(struct kaiju_view *view, enum bridge_event_type type);
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define KAIJU_HISTOGRAM_BUCKETS 24
+
+struct kaiju_server;
+
+/* Histogram of durations with power of two buckets: bucket 0 counts samples
+ * below 1us, bucket i samples in [2^(i-1), 2^i) us, and the last bucket
+ * everything from about 4s upwards. Cheap enough to update on every frame
+ * and every input event. */
+struct kaiju_histogram {
+    uint64_t buckets[KAIJU_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    /** Sum and maximum of all samples, in nanoseconds */
+    int64_t total, max;
+};
+
+struct kaiju_output_stats {
+    /** Frames handed to the output, composited or scanned out */
+    uint64_t frames;
+    /** Frames which bypassed composition through direct scanout */
+    uint64_t scanout_frames;
+    /** Vblanks which passed between a commit and its presentation */
+    uint64_t missed_vblanks;
+    /** Composited frames which had to draw the cursor themselves */
+    uint64_t software_cursor_frames;
+    /** Times the cursor fell back from a hardware plane to software */
+    uint64_t cursor_fallbacks;
+    /** Views whose scene nodes were computed again, and ones which were reused */
+    uint64_t scene_builds, scene_reuses;
+    /** Draw calls of composited frames, and the frames which went through the batch */
+    uint64_t draw_calls, batched_frames;
+    /** CPU time spent in output_repaint, frame callbacks included */
+    struct kaiju_histogram render_time;
+    /** Time between two frames making it on screen */
+    struct kaiju_histogram frame_interval;
+
+    /** When the last frame was committed, while waiting for it to be presented */
+    struct timespec commit_time;
+    bool commit_pending;
+    struct timespec last_present;
+    bool presented;
+};
+
+int64_t timespec_to_nsec(const struct timespec *t);
+int64_t stats_now_nsec(void);
+
+void histogram_add(struct kaiju_histogram *histogram, int64_t nsec);
+/** Upper bound of the bucket which holds the given percentile, in nanoseconds */
+int64_t histogram_percentile(const struct kaiju_histogram *histogram, double percentile);
+
+/** Called right after a frame was committed to the output */
+void output_stats_commit(struct kaiju_output_stats *stats);
+void output_stats_present(struct kaiju_output_stats *stats, const struct timespec *when, int refresh);
+
+/** Records how long an input event took from the device to the seat, given
+ * the event's timestamp in milliseconds */
+void stats_record_input(struct kaiju_server *server, uint32_t time_msec);
+/** Clears the statistics of the server and all of its outputs */
+void stats_reset(struct kaiju_server *server);
+/** Writes all statistics as a single JSON object */
+void stats_write_json(struct kaiju_server *server, FILE *file);
+/** Prints how long it took from startup_time to reach a stage of startup,
+ * if the server keeps track of its startup */
+void stats_startup_mark(struct kaiju_server *server, const char *stage);
+/** Dumps the statistics whenever the compositor receives SIGUSR1 */
+void stats_init(struct kaiju_server *server);
+void stats_finish(struct kaiju_server *server);
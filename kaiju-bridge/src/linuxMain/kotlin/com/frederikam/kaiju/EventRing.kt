@@ -0,0 +1,50 @@
+package com.frederikam.kaiju
+
+import kaiju_core.bridge_event
+import kaiju_core.bridge_event_ring
+import kaiju_core.bridge_event_type
+import kotlinx.cinterop.*
+import kotlin.native.concurrent.ThreadLocal
+
+/**
+ * Consumer side of the event ring, see bridge/events.h.
+ * Records are read in place and tail is only advanced once per batch.
+ * Singletons are frozen by default, and the compositor only ever calls the bridge from its own thread.
+ */
+@ThreadLocal
+object EventRing {
+    var consumed = 0L
+        private set
+
+    fun restore(consumed: Long) {
+        this.consumed = consumed
+    }
+
+    fun drain(ring: CPointer<bridge_event_ring>) {
+        val shared = ring.pointed
+        val events = interpretCPointer<bridge_event>(ring.rawValue + shared.events_offset.toLong())!!
+        val mask = shared.capacity - 1u
+        val head = shared.head
+        var tail = shared.tail
+        while (tail != head) {
+            handle(events[(tail and mask).toLong()])
+            tail++
+        }
+        shared.tail = tail
+    }
+
+    private fun handle(event: bridge_event) {
+        consumed++
+        when (event.type) {
+            bridge_event_type.BRIDGE_EVENT_VIEW_MAP.value ->
+                println("View ${event.data.view.id} mapped at ${event.data.view.x},${event.data.view.y}")
+            bridge_event_type.BRIDGE_EVENT_OUTPUT_ADD.value -> {
+                val output = event.data.output
+                Outputs.all[output.id] = Outputs.Output(output.width, output.height)
+                println("Output ${output.id} added: ${output.width}x${output.height}")
+            }
+            bridge_event_type.BRIDGE_EVENT_OUTPUT_REMOVE.value -> Outputs.all.remove(event.data.output.id)
+            else -> {}
+        }
+    }
+}
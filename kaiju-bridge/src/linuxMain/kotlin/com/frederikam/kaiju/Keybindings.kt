@@ -0,0 +1,46 @@
+package com.frederikam.kaiju
+
+import kaiju_core.bridge_hooks
+import kaiju_core.bridge_keybinding
+import kotlinx.cinterop.*
+import kotlin.native.concurrent.ThreadLocal
+
+/** Modifier masks, matching enum wlr_keyboard_modifier */
+object Modifier {
+    const val SHIFT = 1u
+    const val CTRL = 4u
+    const val ALT = 8u
+    const val LOGO = 64u
+}
+
+/**
+ * Bindings are collected here and handed to the compositor in one table when the bridge is loaded.
+ * The compositor only calls back into Kotlin for key presses which match one of them.
+ * Thread-local rather than frozen, as bindings are added after the object is created.
+ */
+@ThreadLocal
+object Keybindings {
+    private val actions = mutableListOf<() -> Unit>()
+    private val bindings = mutableListOf<Pair<UInt, UInt>>()
+
+    fun bind(modifiers: UInt, keysym: UInt, action: () -> Unit) {
+        bindings.add(modifiers to keysym)
+        actions.add(action)
+    }
+
+    /** Copies the bindings into native memory which stays valid for as long as the bridge is loaded */
+    fun export(hooks: bridge_hooks) {
+        val table = nativeHeap.allocArray<bridge_keybinding>(bindings.size)
+        bindings.forEachIndexed { i, (modifiers, keysym) ->
+            table[i].modifiers = modifiers
+            table[i].keysym = keysym
+            table[i].id = i.toUInt()
+        }
+        hooks.keybindings = table
+        hooks.keybinding_count = bindings.size.toUInt()
+    }
+
+    fun invoke(id: UInt) {
+        actions.getOrNull(id.toInt())?.invoke()
+    }
+}
@@ -0,0 +1,35 @@
+package com.frederikam.kaiju
+
+import kaiju_core.view_props
+import kotlinx.cinterop.*
+import platform.posix.getenv
+import kotlin.native.concurrent.ThreadLocal
+
+/** Outputs as announced through the event ring, by id. Thread-local, as a frozen map could not be updated. */
+@ThreadLocal
+object Outputs {
+    data class Output(val width: Int, val height: Int)
+
+    val all = linkedMapOf<UInt, Output>()
+}
+
+/**
+ * Layouts get every mapped view in one array and change the entries in place.
+ * KAIJU_LAYOUT=columns tiles the views side by side on the first output, anything else leaves them floating.
+ */
+object Layout {
+    private val columns = getenv("KAIJU_LAYOUT")?.toKString() == "columns"
+
+    fun arrange(views: CPointer<view_props>, count: Int) {
+        if (!columns) return
+        val output = Outputs.all.values.firstOrNull() ?: return
+        val width = output.width / count
+        for (i in 0 until count) {
+            val view = views[i]
+            view.x = i * width
+            view.y = 0
+            view.width = width
+            view.height = output.height
+        }
+    }
+}
@@ -1,19 +1,48 @@
 package com.frederikam.kaiju
 
+import kaiju_core.bridge_event_ring
 import kaiju_core.bridge_hooks
+import kaiju_core.view_props
 import kotlinx.cinterop.*
 
+const val XKB_KEY_F1 = 0xffbeu
+
 @Suppress("unused")
 fun kaijuEntry(): bridge_hooks {
     println("Hello from Kaiju-Bridge")
-    memScoped {
-        val hooks = alloc<bridge_hooks>()
-        hooks.onUnload = staticCFunction(::onUnload0)
-        return hooks
-    }
+    // The compositor keeps using the hooks after we return, so they can't live on the stack
+    val hooks = nativeHeap.alloc<bridge_hooks>()
+    hooks.onUnload = staticCFunction(::onUnload0)
+    hooks.onEvents = staticCFunction(::onEvents0)
+    hooks.onKeybinding = staticCFunction(::onKeybinding0)
+    hooks.onSnapshot = staticCFunction(::onSnapshot0)
+    hooks.onRestore = staticCFunction(::onRestore0)
+    hooks.onLayout = staticCFunction(::onLayout0)
+
+    Keybindings.bind(Modifier.ALT, XKB_KEY_F1) { println("Alt+F1 pressed") }
+    Keybindings.export(hooks)
+    return hooks
 }
 
 fun onUnload0(): COpaquePointer? {
     println("Unloaded")
     return null
 }
+
+fun onSnapshot0(buffer: COpaquePointer?, capacity: UInt): UInt = Snapshot.write(buffer, capacity)
+
+fun onRestore0(data: COpaquePointer?, size: UInt) {
+    Snapshot.read(data, size)
+}
+
+fun onKeybinding0(id: UInt) {
+    Keybindings.invoke(id)
+}
+
+fun onLayout0(views: CPointer<view_props>?, count: UInt) {
+    Layout.arrange(views ?: return, count.toInt())
+}
+
+fun onEvents0(ring: CPointer<bridge_event_ring>?) {
+    EventRing.drain(ring ?: return)
+}
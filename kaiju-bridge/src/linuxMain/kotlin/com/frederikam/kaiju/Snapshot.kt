@@ -0,0 +1,29 @@
+package com.frederikam.kaiju
+
+import kotlinx.cinterop.*
+
+/**
+ * State carried over when the compositor live-reloads the bridge.
+ * The layout is private to the bridge, but has to stay compatible between the old and new version of it.
+ */
+object Snapshot {
+    private const val VERSION = 1
+    private const val SIZE = 16
+
+    fun write(buffer: COpaquePointer?, capacity: UInt): UInt {
+        if (buffer == null || capacity < SIZE.toUInt()) return SIZE.toUInt()
+        // An Int version, padding, then the Long counter at offset 8
+        buffer.reinterpret<IntVar>()[0] = VERSION
+        buffer.reinterpret<LongVar>().plus(1)!!.pointed.value = EventRing.consumed
+        return SIZE.toUInt()
+    }
+
+    fun read(data: COpaquePointer?, size: UInt) {
+        if (data == null || size < SIZE.toUInt()) return
+        if (data.reinterpret<IntVar>()[0] != VERSION) {
+            println("Ignoring state of an incompatible bridge")
+            return
+        }
+        EventRing.restore(data.reinterpret<LongVar>().plus(1)!!.pointed.value)
+    }
+}
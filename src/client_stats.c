@@ -0,0 +1,186 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server-core.h>
+#include <wayland-util.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_surface.h>
+
+#include "./include/client_stats.h"
+#include "./include/kaiju_server.h"
+#include "./include/stats.h"
+
+/* Upload rates are averaged over windows of about this length */
+#define CLIENT_STATS_RATE_WINDOW 1000000000LL
+
+static void client_handle_destroy(struct wl_listener *listener, void *data) {
+    struct kaiju_client *client = wl_container_of(listener, client, destroy);
+    struct kaiju_surface_upload *upload, *tmp;
+    wl_list_for_each_safe(upload, tmp, &client->surfaces, link) {
+        wl_list_remove(&upload->link);
+        wl_list_init(&upload->link);
+        upload->client = NULL;
+    }
+    wl_list_remove(&client->destroy.link);
+    wl_list_remove(&client->link);
+    free(client);
+}
+
+static struct kaiju_client *client_get(struct kaiju_server *server, struct wl_client *wl_client) {
+    /* The destroy listener doubles as the lookup from a wl_client to our state */
+    struct wl_listener *listener = wl_client_get_destroy_listener(wl_client, client_handle_destroy);
+    if (listener != NULL) {
+        struct kaiju_client *client = wl_container_of(listener, client, destroy);
+        return client;
+    }
+
+    struct kaiju_client *client = calloc(1, sizeof(struct kaiju_client));
+    if (client == NULL) return NULL;
+    client->client = wl_client;
+    wl_client_get_credentials(wl_client, &client->pid, NULL, NULL);
+    wl_list_init(&client->surfaces);
+    client->destroy.notify = client_handle_destroy;
+    wl_client_add_destroy_listener(wl_client, &client->destroy);
+    wl_list_insert(&server->clients, &client->link);
+    return client;
+}
+
+static void client_add_upload(struct kaiju_client *client, uint64_t bytes) {
+    int64_t now = stats_now_nsec();
+    if (client->window_start == 0) {
+        client->window_start = now;
+    } else if (now - client->window_start >= CLIENT_STATS_RATE_WINDOW) {
+        client->upload_rate = client->window_bytes * 1e9 / (now - client->window_start);
+        client->window_start = now;
+        client->window_bytes = 0;
+    }
+    client->window_bytes += bytes;
+    client->upload_bytes += bytes;
+}
+
+static double client_upload_rate(struct kaiju_client *client) {
+    /* A client which stopped uploading never closes its window, so the rate
+     * of a window that is overdue decays with the time it has been open. */
+    int64_t elapsed = stats_now_nsec() - client->window_start;
+    if (client->window_start != 0 && elapsed >= CLIENT_STATS_RATE_WINDOW) {
+        return client->window_bytes * 1e9 / elapsed;
+    }
+    return client->upload_rate;
+}
+
+static void surface_upload_commit(struct wl_listener *listener, void *data) {
+    /* wlroots has already uploaded the new buffer when it emits the commit */
+    struct kaiju_surface_upload *upload = wl_container_of(listener, upload, commit);
+    struct wlr_surface *surface = upload->surface;
+    struct wlr_texture *texture = wlr_surface_get_texture(surface);
+    struct wl_resource *buffer = surface->current.buffer_resource;
+    struct wl_shm_buffer *shm_buffer = buffer != NULL ? wl_shm_buffer_get(buffer) : NULL;
+    if (upload->client == NULL || texture == NULL || shm_buffer == NULL) {
+        /* dmabufs are imported in place, there is nothing to upload */
+        if (upload->client != NULL && texture != NULL && buffer != NULL &&
+            wlr_dmabuf_v1_resource_is_buffer(buffer) && pixman_region32_not_empty(&surface->buffer_damage)) {
+            upload->client->dmabuf_commits++;
+        }
+        upload->texture = texture;
+        return;
+    }
+
+    int32_t width = wl_shm_buffer_get_width(shm_buffer);
+    int32_t height = wl_shm_buffer_get_height(shm_buffer);
+    int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+    uint32_t format = wl_shm_buffer_get_format(shm_buffer);
+    struct kaiju_client *client = upload->client;
+
+    if (texture != upload->texture) {
+        if (upload->texture != NULL && width == upload->width && height == upload->height &&
+            format == upload->format) {
+            client->texture_reuse_misses++;
+        }
+        client->full_uploads++;
+        client_add_upload(client, (uint64_t) stride * height);
+    } else {
+        int rects_len;
+        pixman_box32_t *rects = pixman_region32_rectangles(&surface->buffer_damage, &rects_len);
+        if (rects_len == 0 || width <= 0) return;
+        uint64_t pixels = 0;
+        for (int i = 0; i < rects_len; i++) {
+            pixels += (uint64_t) (rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+        }
+        client->partial_uploads++;
+        client_add_upload(client, pixels * (stride / width));
+    }
+
+    upload->texture = texture;
+    upload->width = width;
+    upload->height = height;
+    upload->format = format;
+}
+
+static void surface_upload_destroy(struct wl_listener *listener, void *data) {
+    struct kaiju_surface_upload *upload = wl_container_of(listener, upload, destroy);
+    wl_list_remove(&upload->link);
+    wl_list_remove(&upload->commit.link);
+    wl_list_remove(&upload->destroy.link);
+    pool_free(&upload->server->surface_pool, upload);
+}
+
+static void server_new_surface(struct wl_listener *listener, void *data) {
+    struct kaiju_server *server = wl_container_of(listener, server, new_surface);
+    struct wlr_surface *surface = data;
+    struct kaiju_client *client = client_get(server, wl_resource_get_client(surface->resource));
+    if (client == NULL) return;
+
+    struct kaiju_surface_upload *upload = pool_alloc(&server->surface_pool);
+    upload->server = server;
+    upload->surface = surface;
+    upload->client = client;
+    wl_list_insert(&client->surfaces, &upload->link);
+    upload->commit.notify = surface_upload_commit;
+    wl_signal_add(&surface->events.commit, &upload->commit);
+    upload->destroy.notify = surface_upload_destroy;
+    wl_signal_add(&surface->events.destroy, &upload->destroy);
+}
+
+void client_stats_init(struct kaiju_server *server) {
+    wl_list_init(&server->clients);
+    server->new_surface.notify = server_new_surface;
+    wl_signal_add(&server->compositor->events.new_surface, &server->new_surface);
+}
+
+void client_stats_finish(struct kaiju_server *server) {
+    wl_list_remove(&server->new_surface.link);
+}
+
+void client_stats_reset(struct kaiju_server *server) {
+    struct kaiju_client *client;
+    wl_list_for_each(client, &server->clients, link) {
+        client->upload_bytes = 0;
+        client->partial_uploads = 0;
+        client->full_uploads = 0;
+        client->texture_reuse_misses = 0;
+        client->dmabuf_commits = 0;
+        client->window_start = 0;
+        client->window_bytes = 0;
+        client->upload_rate = 0;
+    }
+}
+
+void client_stats_write_json(struct kaiju_server *server, FILE *file) {
+    fprintf(file, "[");
+    bool first = true;
+    struct kaiju_client *client;
+    wl_list_for_each(client, &server->clients, link) {
+        fprintf(file, "%s{\"pid\":%d,\"upload_bytes\":%llu,\"upload_bytes_per_sec\":%.0f,"
+                      "\"partial_uploads\":%llu,\"full_uploads\":%llu,\"texture_reuse_misses\":%llu,"
+                      "\"dmabuf_commits\":%llu}",
+                first ? "" : ",", (int) client->pid, (unsigned long long) client->upload_bytes,
+                client_upload_rate(client), (unsigned long long) client->partial_uploads,
+                (unsigned long long) client->full_uploads,
+                (unsigned long long) client->texture_reuse_misses,
+                (unsigned long long) client->dmabuf_commits);
+        first = false;
+    }
+    fprintf(file, "]");
+}
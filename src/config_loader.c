@@ -1,13 +1,71 @@
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_output.h>
 #include "./include/bridge.h" // Hardcoded header
 #include "./include/bridge/hooks.h"
+#include "./include/config_loader.h"
+#include "./include/kaiju_output.h"
+#include "./include/kaiju_server.h"
+
+/* Build tools tend to write the library in several steps, so we wait for
+ * things to settle before reloading. */
+#define RELOAD_DEBOUNCE_MS 250
+#define SNAPSHOT_INITIAL_SIZE 4096
 
 void *handle = NULL;
 libkaiju_bridge_ExportedSymbols* (*getSymbols)(void);
+struct bridge_hooks *bridge_hooks = NULL;
+
+/* State of loading and reloading the bridge. Copying and dlopening the
+ * library happens on a worker thread. Entering it and swapping it in runs on
+ * the compositor's thread, in between two frames, as Kotlin/Native objects
+ * are bound to the thread that created them. */
+struct config_reload {
+    struct kaiju_server *server;
+    char path[PATH_MAX];
+    const char *file_name;
+    int inotify_fd;
+    struct wl_event_source *inotify_source;
+    struct wl_event_source *debounce_timer;
+
+    /* Signalled by the worker once it is done */
+    int done_fd;
+    struct wl_event_source *done_source;
+    pthread_t thread;
+    bool loading;
+    /** Load from a private copy, as the library at path is already loaded */
+    bool use_copy;
+    /** The library changed again while the worker was busy */
+    bool changed;
+    int generation;
+    /** Replaced bridges, which stay loaded, see config_swap */
+    int resident;
+
+    /* Results of the worker, only touched by the main thread once done_fd
+     * has been signalled */
+    void *new_handle;
+    char error[256];
+    int64_t load_time;
+};
+
+static struct config_reload reload = {
+        .inotify_fd = -1,
+        .done_fd = -1,
+};
 
 static const char *get_config_path() {
     const char *gradleBuildSo = "./kaiju-bridge/build/bin/linux/releaseShared/libkaiju_bridge.so";
@@ -18,19 +76,276 @@ static const char *get_config_path() {
     return NULL;
 }
 
-void config_load() {
+static struct bridge_hooks *config_enter(void *new_handle) {
+    getSymbols = (libkaiju_bridge_ExportedSymbols* (*)(void))dlsym(new_handle, "libkaiju_bridge_symbols");
+    return getSymbols()->kotlin.root.com.frederikam.kaiju.kaijuEntry();
+}
+
+void config_unload() {
+    if (bridge_hooks == NULL) return;
+    bridge_hooks->onUnload();
+    bridge_hooks = NULL;
+}
+
+static bool copy_file(const char *from, const char *to) {
+    int in = open(from, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0700);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    char buffer[65536];
+    ssize_t n;
+    bool ok = true;
+    while ((n = read(in, buffer, sizeof(buffer))) > 0) {
+        if (write(out, buffer, n) != n) {
+            ok = false;
+            break;
+        }
+    }
+    close(in);
+    close(out);
+    return ok && n == 0;
+}
+
+static void *config_reload_thread(void *data) {
+    /* dlopen caches libraries by path, so the new library is loaded from a
+     * private copy. The copy is unlinked right away, the mapping keeps it
+     * alive for as long as it is loaded. */
+    struct config_reload *state = data;
+    int64_t start = stats_now_nsec();
+
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    char copy[PATH_MAX];
+    snprintf(copy, sizeof(copy), "%s/kaiju-bridge-%d-%d.so", dir != NULL ? dir : "/tmp",
+             (int) getpid(), state->generation);
+    const char *path = state->use_copy ? copy : state->path;
+
+    state->new_handle = NULL;
+    state->error[0] = '\0';
+    if (state->use_copy && !copy_file(state->path, copy)) {
+        snprintf(state->error, sizeof(state->error), "failed to copy '%s' to '%s'", state->path, copy);
+    } else {
+        state->new_handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (state->new_handle == NULL) {
+            snprintf(state->error, sizeof(state->error), "%s", dlerror());
+        } else if (dlsym(state->new_handle, "libkaiju_bridge_symbols") == NULL) {
+            snprintf(state->error, sizeof(state->error), "'libkaiju_bridge_symbols' is missing");
+            dlclose(state->new_handle);
+            state->new_handle = NULL;
+        }
+        if (state->use_copy) unlink(copy);
+    }
+    state->load_time = stats_now_nsec() - start;
+
+    uint64_t done = 1;
+    if (write(state->done_fd, &done, sizeof(done)) != sizeof(done)) {
+        perror("Failed to signal bridge reload");
+    }
+    return NULL;
+}
+
+static void config_reload_start(struct config_reload *state) {
+    if (state->loading) {
+        state->changed = true;
+        return;
+    }
+    state->loading = true;
+    state->changed = false;
+    state->use_copy = handle != NULL;
+    state->generation++;
+    if (pthread_create(&state->thread, NULL, config_reload_thread, state) != 0) {
+        fprintf(stderr, "Failed to start bridge reload\n");
+        state->loading = false;
+    }
+}
+
+static void *config_snapshot(uint32_t *size) {
+    /* The bridge tells us how much space it needs if the buffer is too small */
+    if (bridge_hooks->onSnapshot == NULL) return NULL;
+    uint32_t capacity = SNAPSHOT_INITIAL_SIZE;
+    void *buffer = malloc(capacity);
+    *size = bridge_hooks->onSnapshot(buffer, capacity);
+    if (*size > capacity) {
+        free(buffer);
+        capacity = *size;
+        buffer = malloc(capacity);
+        *size = bridge_hooks->onSnapshot(buffer, capacity);
+        if (*size > capacity) *size = 0;
+    }
+    return buffer;
+}
+
+static int64_t config_frame_budget(struct kaiju_server *server) {
+    /* The shortest refresh period of any output, which is how long the swap
+     * may take before some output misses a frame */
+    int64_t budget = 0;
+    struct kaiju_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (output->wlr_output->refresh <= 0) continue;
+        int64_t period = 1000000000000LL / output->wlr_output->refresh;
+        if (budget == 0 || period < budget) budget = period;
+    }
+    return budget;
+}
+
+static void config_swap(struct config_reload *state) {
+    struct kaiju_server *server = state->server;
+    int64_t start = stats_now_nsec();
+    bool reloading = handle != NULL;
+
+    /* Entering the bridge starts its Kotlin runtime, which has to happen on
+     * the thread its hooks are called from. This is the bulk of the time
+     * spent here, and the old bridge stays attached until it succeeded. */
+    struct bridge_hooks *new_hooks = config_enter(state->new_handle);
+    int64_t enter_time = stats_now_nsec() - start;
+    if (new_hooks == NULL) {
+        fprintf(stderr, "Failed to enter bridge%s: kaijuEntry returned no hooks\n",
+                reloading ? ", keeping the old one" : "");
+        /* Its runtime may be half started, so it stays loaded, see below */
+        state->resident++;
+        return;
+    }
+
+    /* Quiesce the old bridge: hand it whatever is still queued, detach it so
+     * that it is not called anymore, and take its state with us. */
+    uint32_t snapshot_size = 0;
+    void *snapshot = NULL;
+    if (bridge_hooks != NULL) {
+        event_ring_drain(&server->event_ring);
+        server_set_bridge(server, NULL);
+        snapshot = config_snapshot(&snapshot_size);
+        config_unload();
+    }
+    /* The old library is never dlclosed. A Kotlin/Native runtime can't be
+     * unloaded safely, it leaves threads and TLS destructors behind which
+     * would then point into unmapped code. Each reload thus costs the memory
+     * of one more copy of the bridge. */
+    if (handle != NULL) state->resident++;
+
+    handle = state->new_handle;
+    bridge_hooks = new_hooks;
+    if (snapshot != NULL && bridge_hooks->onRestore != NULL) {
+        bridge_hooks->onRestore(snapshot, snapshot_size);
+    }
+    free(snapshot);
+    server_set_bridge(server, bridge_hooks);
+
+    int64_t swap_time = stats_now_nsec() - start;
+    int64_t budget = config_frame_budget(server);
+    if (reloading) {
+        printf("Reloaded bridge: loaded in %.1f ms off-thread, entered in %.2f ms, swapped in %.2f ms "
+               "(%u bytes of state, %d old bridges resident)\n",
+               state->load_time / 1e6, enter_time / 1e6, (swap_time - enter_time) / 1e6,
+               snapshot_size, state->resident);
+    } else {
+        printf("Loaded bridge: loaded in %.1f ms off-thread, entered in %.2f ms\n",
+               state->load_time / 1e6, swap_time / 1e6);
+        stats_startup_mark(server, "bridge ready");
+    }
+    /* The swap runs right after the worker is done, not timed against any
+     * output's vblank, so taking longer than the shortest refresh cycle means
+     * some output may have missed a frame */
+    if (budget > 0 && swap_time > budget) {
+        fprintf(stderr, "Bridge swap took %.2f ms, longer than a refresh cycle (%.2f ms), "
+                        "of which %.2f ms were spent in kaijuEntry\n",
+                swap_time / 1e6, budget / 1e6, enter_time / 1e6);
+    }
+}
+
+static int config_handle_reload_done(int fd, uint32_t mask, void *data) {
+    struct config_reload *state = data;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) return 0;
+
+    pthread_join(state->thread, NULL);
+    state->loading = false;
+    if (state->new_handle == NULL) {
+        fprintf(stderr, "Failed to load bridge%s: %s\n",
+                handle != NULL ? ", keeping the old one" : "", state->error);
+    } else {
+        config_swap(state);
+        state->new_handle = NULL;
+    }
+
+    if (state->changed) config_reload_start(state);
+    return 0;
+}
+
+static int config_handle_debounce(void *data) {
+    config_reload_start(data);
+    return 0;
+}
+
+static int config_handle_inotify(int fd, uint32_t mask, void *data) {
+    struct config_reload *state = data;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(fd, buffer, sizeof(buffer));
+    bool changed = false;
+    for (char *ptr = buffer; len > 0 && ptr < buffer + len;) {
+        struct inotify_event *event = (struct inotify_event *) ptr;
+        if (event->len > 0 && strcmp(event->name, state->file_name) == 0) changed = true;
+        ptr += sizeof(struct inotify_event) + event->len;
+    }
+    if (changed) wl_event_source_timer_update(state->debounce_timer, RELOAD_DEBOUNCE_MS);
+    return 0;
+}
+
+void config_load(struct kaiju_server *server) {
     const char *path = get_config_path();
     if (path == NULL) {
         fprintf(stderr, "Unable to find 'libkaiju_bridge.so'\n");
         exit(-1);
     }
-
     fprintf(stdout, "Using '%s' as configuration\n", path);
-    handle = dlopen(path, RTLD_NOW);
-    assert(handle);
-
-    fprintf(stdout, "Loaded SO: '%p'\n", handle);
-    getSymbols = (libkaiju_bridge_ExportedSymbols* (*)(void))dlsym(handle, "libkaiju_bridge_symbols");
-    struct bridge_hooks* hooks = getSymbols()->kotlin.root.com.frederikam.kaiju.kaijuEntry();
-    hooks->onUnload();
-}
\ No newline at end of file
+    snprintf(reload.path, sizeof(reload.path), "%s", path);
+    reload.server = server;
+
+    reload.done_fd = eventfd(0, EFD_CLOEXEC);
+    assert(reload.done_fd >= 0);
+    reload.done_source = wl_event_loop_add_fd(server->wl_event_loop, reload.done_fd, WL_EVENT_READABLE,
+                                              config_handle_reload_done, &reload);
+    config_reload_start(&reload);
+}
+
+void config_watch(struct kaiju_server *server) {
+    /* Watch the directory rather than the file, as builds usually replace the
+     * file instead of writing to it. */
+    if (reload.done_source == NULL) return;
+    reload.file_name = strrchr(reload.path, '/') != NULL ? strrchr(reload.path, '/') + 1 : reload.path;
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", reload.path);
+
+    reload.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (reload.inotify_fd < 0 ||
+        inotify_add_watch(reload.inotify_fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror("Failed to watch the bridge, live reload is disabled");
+        if (reload.inotify_fd >= 0) close(reload.inotify_fd);
+        reload.inotify_fd = -1;
+        return;
+    }
+
+    struct wl_event_loop *loop = server->wl_event_loop;
+    reload.inotify_source = wl_event_loop_add_fd(loop, reload.inotify_fd, WL_EVENT_READABLE,
+                                                 config_handle_inotify, &reload);
+    reload.debounce_timer = wl_event_loop_add_timer(loop, config_handle_debounce, &reload);
+}
+
+void config_unwatch() {
+    if (reload.loading) {
+        pthread_join(reload.thread, NULL);
+        reload.loading = false;
+        /* Never entered, so no runtime was started that could be left behind */
+        if (reload.new_handle != NULL) dlclose(reload.new_handle);
+        reload.new_handle = NULL;
+    }
+    if (reload.inotify_source != NULL) wl_event_source_remove(reload.inotify_source);
+    if (reload.done_source != NULL) wl_event_source_remove(reload.done_source);
+    if (reload.debounce_timer != NULL) wl_event_source_remove(reload.debounce_timer);
+    reload.inotify_source = reload.done_source = reload.debounce_timer = NULL;
+    if (reload.inotify_fd >= 0) close(reload.inotify_fd);
+    if (reload.done_fd >= 0) close(reload.done_fd);
+    reload.inotify_fd = reload.done_fd = -1;
+}
@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+
+#include "./include/bridge/hooks.h"
+#include "./include/event_ring.h"
+
+bool event_ring_init(struct kaiju_event_ring *ring, struct wl_event_loop *loop, uint32_t capacity) {
+    memset(ring, 0, sizeof(struct kaiju_event_ring));
+    ring->fd = -1;
+    ring->loop = loop;
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        fprintf(stderr, "Event ring capacity %u is not a power of two\n", capacity);
+        return false;
+    }
+
+    /* The ring lives in a memfd rather than on the heap, so that the bridge
+     * can just as well map it from another thread or process. */
+    size_t offset = (sizeof(struct bridge_event_ring) + 63) & ~(size_t) 63;
+    ring->size = offset + (size_t) capacity * sizeof(struct bridge_event);
+    ring->fd = memfd_create("kaiju-events", MFD_CLOEXEC);
+    if (ring->fd < 0 || ftruncate(ring->fd, ring->size) < 0) {
+        perror("Failed to allocate event ring");
+        event_ring_finish(ring);
+        return false;
+    }
+    ring->shared = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (ring->shared == MAP_FAILED) {
+        perror("Failed to map event ring");
+        ring->shared = NULL;
+        event_ring_finish(ring);
+        return false;
+    }
+
+    ring->shared->capacity = capacity;
+    ring->shared->events_offset = offset;
+    return true;
+}
+
+void event_ring_finish(struct kaiju_event_ring *ring) {
+    if (ring->drain_idle != NULL) {
+        wl_event_source_remove(ring->drain_idle);
+        ring->drain_idle = NULL;
+    }
+    if (ring->shared != NULL) {
+        munmap(ring->shared, ring->size);
+        ring->shared = NULL;
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+void event_ring_drain(struct kaiju_event_ring *ring) {
+    if (ring->drain_idle != NULL) {
+        wl_event_source_remove(ring->drain_idle);
+        ring->drain_idle = NULL;
+    }
+    /* Nothing is recorded while no bridge is attached, e.g. during a reload.
+     * The next bridge is told about existing outputs and views when it
+     * attaches instead, see server_set_bridge. */
+    if (ring->hooks == NULL || ring->hooks->onEvents == NULL) return;
+    struct bridge_event_ring *shared = ring->shared;
+    if (__atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE) == shared->head) return;
+    ring->hooks->onEvents(shared);
+}
+
+static void event_ring_drain_idle(void *data) {
+    struct kaiju_event_ring *ring = data;
+    /* Idle sources remove themselves after running */
+    ring->drain_idle = NULL;
+    event_ring_drain(ring);
+}
+
+void event_ring_push(struct kaiju_event_ring *ring, const struct bridge_event *event, bool droppable) {
+    if (ring->shared == NULL || ring->hooks == NULL || ring->hooks->onEvents == NULL) return;
+    struct bridge_event_ring *shared = ring->shared;
+
+    uint32_t head = shared->head;
+    if (head - __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE) == shared->capacity) {
+        /* Back-pressure: motion is superseded by the next motion record
+         * anyway, but losing a key or button would confuse the bridge. */
+        if (!droppable) {
+            shared->stalls++;
+            event_ring_drain(ring);
+        }
+        if (head - __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE) == shared->capacity) {
+            shared->dropped++;
+            return;
+        }
+    }
+
+    struct bridge_event *events = (struct bridge_event *) ((char *) shared + shared->events_offset);
+    events[head & (shared->capacity - 1)] = *event;
+    shared->produced++;
+    __atomic_store_n(&shared->head, head + 1, __ATOMIC_RELEASE);
+
+    if (ring->drain_idle == NULL) {
+        ring->drain_idle = wl_event_loop_add_idle(ring->loop, event_ring_drain_idle, ring);
+    }
+}
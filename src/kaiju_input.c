@@ -1,10 +1,13 @@
 #include <stdlib.h>
+#include <string.h>
 #include <wayland-util.h>
 #include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_relative_pointer_v1.h>
 #include <wlr/util/edges.h>
 #include <wlr/types/wlr_xcursor_manager.h>
 #include "./shell/kaiju_view.h"
 #include "./kaiju_input.h"
+#include "./bridge/hooks.h"
 
 static void keyboard_handle_modifiers(struct wl_listener *listener, void *data) {
     /* This event is raised when a modifier key, such as shift or alt, is
@@ -24,8 +27,13 @@ static void keyboard_handle_modifiers(struct wl_listener *listener, void *data)
     );
 }
 
-static bool handle_keybinding(struct kaiju_server *server, xkb_keysym_t sym) {
-    return false;
+static bool handle_keybinding(struct kaiju_server *server, uint32_t modifiers, xkb_keysym_t sym) {
+    /* A single lookup in the compiled table, the bridge is only called for
+     * key presses which actually match one of its bindings. */
+    const struct kaiju_keybinding *binding = keybindings_find(&server->keybindings, modifiers, sym);
+    if (binding == NULL || server->bridge == NULL || server->bridge->onKeybinding == NULL) return false;
+    server->bridge->onKeybinding(binding->id);
+    return true;
 }
 
 static void keyboard_handle_key(struct wl_listener *listener, void *data) {
@@ -45,19 +53,32 @@ static void keyboard_handle_key(struct wl_listener *listener, void *data) {
             &syms
     );
 
-    bool handled = false;
     uint32_t modifiers = wlr_keyboard_get_modifiers(keyboard->device->keyboard);
-    if ((modifiers & WLR_MODIFIER_ALT) && event->state == WLR_KEY_PRESSED) {
-        /* If alt is held down and this button was _pressed_, we attempt to
-         * process it as a compositor keybinding. */
-        for (int i = 0; i < nsyms; i++) {
-            handled = handle_keybinding(server, syms[i]);
+    struct bridge_event record = {
+            .type = BRIDGE_EVENT_KEY,
+            .time_msec = event->time_msec,
+            .data.key = {
+                    .keycode = event->keycode,
+                    .state = event->state,
+                    .modifiers = modifiers,
+                    .keysym = nsyms > 0 ? syms[0] : XKB_KEY_NoSymbol,
+            },
+    };
+    event_ring_push(&server->event_ring, &record, false);
+
+    bool handled = false;
+    if (event->state == WLR_KEY_PRESSED) {
+        /* If this button was _pressed_, we attempt to process it as a
+         * compositor keybinding. */
+        for (int i = 0; i < nsyms && !handled; i++) {
+            handled = handle_keybinding(server, modifiers, syms[i]);
         }
     }
 
     if (handled) return;
     /* Otherwise, we pass it along to the client. */
     wlr_seat_set_keyboard(seat, keyboard->device);
+    stats_record_input(server, event->time_msec);
     wlr_seat_keyboard_notify_key(seat, event->time_msec, event->keycode, event->state);
 }
 
@@ -125,6 +146,69 @@ static void server_new_input(struct wl_listener *listener, void *data) {
     wlr_seat_set_capabilities(server->seat, caps);
 }
 
+static void cursor_forget_surface(struct kaiju_server *server) {
+    if (server->cursor_surface == NULL) return;
+    wl_list_remove(&server->cursor_surface_destroy.link);
+    server->cursor_surface = NULL;
+}
+
+static void cursor_handle_surface_destroy(struct wl_listener *listener, void *data) {
+    struct kaiju_server *server = wl_container_of(listener, server, cursor_surface_destroy);
+    cursor_forget_surface(server);
+}
+
+static void cursor_set_image(struct kaiju_server *server, const char *name) {
+    /* Setting an image uploads it to the cursor plane of every output, or
+     * repaints the software cursor, so we only do it when it changes. */
+    if (server->cursor_image != NULL && strcmp(server->cursor_image, name) == 0) {
+        server->cursor_image_skips++;
+        return;
+    }
+    cursor_forget_surface(server);
+    free(server->cursor_image);
+    server->cursor_image = strdup(name);
+    server->cursor_image_sets++;
+    wlr_xcursor_manager_set_cursor_image(server->cursor_mgr, name, server->cursor);
+}
+
+void cursor_refresh_image(struct kaiju_server *server) {
+    /* wlr_cursor gives outputs which join the layout a cursor without an
+     * image, so the current one is set again rather than skipped */
+    if (server->cursor_image != NULL) {
+        char *name = server->cursor_image;
+        server->cursor_image = NULL;
+        cursor_set_image(server, name);
+        free(name);
+    } else if (server->cursor_surface != NULL) {
+        server->cursor_image_sets++;
+        wlr_cursor_set_surface(server->cursor, server->cursor_surface,
+                               server->cursor_hotspot_x, server->cursor_hotspot_y);
+    }
+}
+
+static void cursor_set_surface(struct kaiju_server *server, struct wlr_surface *surface,
+                               int32_t hotspot_x, int32_t hotspot_y) {
+    /* Clients tend to set their cursor again every time the pointer enters
+     * one of their surfaces. */
+    if (server->cursor_image == NULL && server->cursor_surface == surface && surface != NULL &&
+        server->cursor_hotspot_x == hotspot_x && server->cursor_hotspot_y == hotspot_y) {
+        server->cursor_image_skips++;
+        return;
+    }
+    cursor_forget_surface(server);
+    free(server->cursor_image);
+    server->cursor_image = NULL;
+    server->cursor_image_sets++;
+    if (surface != NULL) {
+        server->cursor_surface = surface;
+        server->cursor_hotspot_x = hotspot_x;
+        server->cursor_hotspot_y = hotspot_y;
+        server->cursor_surface_destroy.notify = cursor_handle_surface_destroy;
+        wl_signal_add(&surface->events.destroy, &server->cursor_surface_destroy);
+    }
+    wlr_cursor_set_surface(server->cursor, surface, hotspot_x, hotspot_y);
+}
+
 static void seat_request_cursor(struct wl_listener *listener, void *data) {
     struct kaiju_server *server = wl_container_of(listener, server, request_cursor);
     /* This event is raised by the seat when a client provides a cursor image */
@@ -138,8 +222,7 @@ static void seat_request_cursor(struct wl_listener *listener, void *data) {
          * provided surface as the cursor image. It will set the hardware cursor
          * on the output that it's currently on and continue to do so as the
          * cursor moves between outputs. */
-        wlr_cursor_set_surface(server->cursor, event->surface,
-                               event->hotspot_x, event->hotspot_y);
+        cursor_set_surface(server, event->surface, event->hotspot_x, event->hotspot_y);
     }
 }
 
@@ -176,24 +259,30 @@ static bool view_at(struct kaiju_view *view,
     return false;
 }
 
-static struct kaiju_view *desktop_view_at(
+struct kaiju_view *desktop_view_at(
         struct kaiju_server *server, double lx, double ly,
         struct wlr_surface **surface, double *sx, double *sy) {
-    /* This iterates over all of our surfaces and attempts to find one under the
-     * cursor. This relies on server->views being ordered from top-to-bottom. */
-    struct kaiju_view *view;
-    wl_list_for_each(view, &server->views, link) {
-        if (view_at(view, lx, ly, surface, sx, sy)) {
-            return view;
+    /* This asks the view index for the views whose bounds cover the cursor,
+     * and attempts to find a surface under the cursor among them. The index
+     * hands them to us ordered from top-to-bottom. */
+    size_t count;
+    struct kaiju_view **views = view_index_candidates(&server->view_index, lx, ly, &count);
+    for (size_t i = 0; i < count; i++) {
+        if (view_at(views[i], lx, ly, surface, sx, sy)) {
+            return views[i];
         }
     }
     return NULL;
 }
 
 static void process_cursor_move(struct kaiju_server *server, uint32_t time) {
-    // Move the grabbed view to the new position.
-    server->grabbed_view->props.x = server->cursor->x - server->grab_x;
-    server->grabbed_view->props.y = server->cursor->y - server->grab_y;
+    // Move the grabbed view to the new position, damaging where it was and where it ends up.
+    struct kaiju_view *view = server->grabbed_view;
+    view_damage(view, true);
+    view->props.x = server->cursor->x - server->grab_x;
+    view->props.y = server->cursor->y - server->grab_y;
+    view_index_update(&server->view_index, view);
+    view_damage(view, true);
 }
 
 static void process_cursor_resize(struct kaiju_server *server, uint32_t time) {
@@ -203,9 +292,10 @@ static void process_cursor_resize(struct kaiju_server *server, uint32_t time) {
      * on one or two axes, but can also move the view if you resize from the top
      * or left edges (or top-left corner).
      *
-     * Note that I took some shortcuts here. In a more fleshed-out compositor,
-     * you'd wait for the client to prepare a buffer at the new size, then
-     * commit any movement that was prepared.
+     * The view does not move right away. view_resize keeps at most one
+     * configure in flight and only applies the new position once the client
+     * commits a buffer at the size we asked for, so the opposite edge stays
+     * put instead of jittering.
      */
     struct kaiju_view *view = server->grabbed_view;
     double dx = server->cursor->x - server->grab_x;
@@ -232,12 +322,23 @@ static void process_cursor_resize(struct kaiju_server *server, uint32_t time) {
     } else if (server->resize_edges & WLR_EDGE_RIGHT) {
         width += dx;
     }
-    view->props.x = x;
-    view->props.y = y;
-    wlr_xdg_toplevel_set_size(view->xdg_surface, width, height);
+    struct wlr_box geometry = {
+            .x = x,
+            .y = y,
+            .width = width,
+            .height = height,
+    };
+    view_resize(view, &geometry, server->resize_edges);
 }
 
 static void process_cursor_motion(struct kaiju_server *server, uint32_t time) {
+    struct bridge_event record = {
+            .type = BRIDGE_EVENT_POINTER_MOTION,
+            .time_msec = time,
+            .data.motion = {server->cursor->x, server->cursor->y},
+    };
+    event_ring_push(&server->event_ring, &record, true);
+
     /* If the mode is non-passthrough, delegate to those functions. */
     if (server->cursor_mode == KAIJU_CURSOR_MOVE) {
         process_cursor_move(server, time);
@@ -261,7 +362,7 @@ static void process_cursor_motion(struct kaiju_server *server, uint32_t time) {
         /* If there's no view under the cursor, set the cursor image to a
          * default. This is what makes the cursor image appear when you move it
          * around the screen, not over any views. */
-        wlr_xcursor_manager_set_cursor_image(server->cursor_mgr, "left_ptr", server->cursor);
+        cursor_set_image(server, "left_ptr");
     }
     if (surface) {
         bool focus_changed = seat->pointer_state.focused_surface != surface;
@@ -273,6 +374,7 @@ static void process_cursor_motion(struct kaiju_server *server, uint32_t time) {
          * from keyboard focus. You get pointer focus by moving the pointer over
          * a window.
          */
+        stats_record_input(server, time);
         wlr_seat_pointer_notify_enter(seat, surface, sx, sy);
         if (!focus_changed) {
             /* The enter event contains coordinates, so we only need to notify
@@ -286,6 +388,26 @@ static void process_cursor_motion(struct kaiju_server *server, uint32_t time) {
     }
 }
 
+static void queue_cursor_motion(struct kaiju_server *server, uint32_t time) {
+    /* High polling rate mice send several motion events per displayed frame.
+     * When coalescing, the cursor image still follows every event, but the
+     * hit-test and seat notifications only happen once per pointer frame. */
+    if (!server->coalesce_motion) {
+        process_cursor_motion(server, time);
+        return;
+    }
+    server->motion_pending = true;
+    server->motion_pending_time = time;
+}
+
+static void flush_cursor_motion(struct kaiju_server *server) {
+    /* Must run before anything else is sent to the focused client, so that
+     * e.g. a button press is delivered to the surface it happened over. */
+    if (!server->motion_pending) return;
+    server->motion_pending = false;
+    process_cursor_motion(server, server->motion_pending_time);
+}
+
 static void server_cursor_motion(struct wl_listener *listener, void *data) {
     /* This event is forwarded by the cursor when a pointer emits a _relative_
      * pointer motion event (i.e. a delta) */
@@ -298,7 +420,15 @@ static void server_cursor_motion(struct wl_listener *listener, void *data) {
      * the cursor around without any input. */
     wlr_cursor_move(server->cursor, event->device,
                     event->delta_x, event->delta_y);
-    process_cursor_motion(server, event->time_msec);
+    /* Relative motion is never coalesced, clients which care about it (e.g.
+     * games using pointer locks) get every single delta. */
+    wlr_relative_pointer_manager_v1_send_relative_motion(
+            server->relative_pointer_manager, server->seat,
+            (uint64_t) event->time_msec * 1000,
+            event->delta_x, event->delta_y,
+            event->unaccel_dx, event->unaccel_dy
+    );
+    queue_cursor_motion(server, event->time_msec);
 }
 
 static void server_cursor_motion_absolute(struct wl_listener *listener, void *data) {
@@ -311,7 +441,7 @@ static void server_cursor_motion_absolute(struct wl_listener *listener, void *da
     struct kaiju_server *server = wl_container_of(listener, server, cursor_motion_absolute);
     struct wlr_event_pointer_motion_absolute *event = data;
     wlr_cursor_warp_absolute(server->cursor, event->device, event->x, event->y);
-    process_cursor_motion(server, event->time_msec);
+    queue_cursor_motion(server, event->time_msec);
 }
 
 static void server_cursor_button(struct wl_listener *listener, void *data) {
@@ -319,8 +449,16 @@ static void server_cursor_button(struct wl_listener *listener, void *data) {
      * event. */
     struct kaiju_server *server = wl_container_of(listener, server, cursor_button);
     struct wlr_event_pointer_button *event = data;
+    flush_cursor_motion(server);
     /* Notify the client with pointer focus that a button press has occurred */
+    stats_record_input(server, event->time_msec);
     wlr_seat_pointer_notify_button(server->seat, event->time_msec, event->button, event->state);
+    struct bridge_event record = {
+            .type = BRIDGE_EVENT_POINTER_BUTTON,
+            .time_msec = event->time_msec,
+            .data.button = {event->button, event->state},
+    };
+    event_ring_push(&server->event_ring, &record, false);
     double sx, sy;
     struct wlr_surface *surface;
     struct kaiju_view *view = desktop_view_at(server,
@@ -339,7 +477,9 @@ static void server_cursor_axis(struct wl_listener *listener, void *data) {
      * for example when you move the scroll wheel. */
     struct kaiju_server *server = wl_container_of(listener, server, cursor_axis);
     struct wlr_event_pointer_axis *event = data;
+    flush_cursor_motion(server);
     /* Notify the client with pointer focus of the axis event. */
+    stats_record_input(server, event->time_msec);
     wlr_seat_pointer_notify_axis(
             server->seat,
             event->time_msec,
@@ -356,6 +496,8 @@ static void server_cursor_frame(struct wl_listener *listener, void *data) {
      * multiple events together. For instance, two axis events may happen at the
      * same time, in which case a frame event won't be sent in between. */
     struct kaiju_server *server = wl_container_of(listener, server, cursor_frame);
+    /* Any motion we held back is processed now, once for the whole frame. */
+    flush_cursor_motion(server);
     /* Notify the client with pointer focus of the frame event. */
     wlr_seat_pointer_notify_frame(server->seat);
 }
@@ -389,6 +531,14 @@ void configure_input(struct kaiju_server *server) {
     server->cursor_frame.notify = server_cursor_frame;
     wl_signal_add(&server->cursor->events.frame, &server->cursor_frame);
 
+    /* Motion coalescing relies on the input device grouping its events with
+     * frame events, which libinput and the nested backends all do. Set
+     * KAIJU_COALESCE_MOTION=1 to enable it. */
+    const char *coalesce = getenv("KAIJU_COALESCE_MOTION");
+    server->coalesce_motion = coalesce != NULL && strcmp(coalesce, "1") == 0;
+    server->motion_pending = false;
+    server->relative_pointer_manager = wlr_relative_pointer_manager_v1_create(server->wl_display);
+
     /*
 	 * Configures a seat, which is a single "seat" at which a user sits and
 	 * operates the computer. This conceptually includes up to one keyboard,
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/types/wlr_keyboard.h>
+#include "./include/keybindings.h"
+
+/* Lock modifiers don't change what a binding means */
+#define KEYBINDING_IGNORED_MODIFIERS (WLR_MODIFIER_CAPS | WLR_MODIFIER_MOD2)
+
+static uint32_t keybinding_hash(uint32_t modifiers, xkb_keysym_t keysym) {
+    uint32_t hash = keysym * 0x9e3779b1u;
+    hash ^= modifiers * 0x85ebca6bu;
+    return hash ^ (hash >> 15);
+}
+
+static void keybinding_normalize(uint32_t *modifiers, xkb_keysym_t *keysym) {
+    *modifiers &= ~KEYBINDING_IGNORED_MODIFIERS;
+    *keysym = xkb_keysym_to_lower(*keysym);
+}
+
+static struct kaiju_keybinding *keybindings_slot(const struct kaiju_keybindings *bindings,
+                                                 uint32_t modifiers, xkb_keysym_t keysym) {
+    /* Linear probing, there always is a free slot to stop at */
+    size_t mask = bindings->capacity - 1;
+    size_t i = keybinding_hash(modifiers, keysym) & mask;
+    while (bindings->slots[i].used &&
+           (bindings->slots[i].modifiers != modifiers || bindings->slots[i].keysym != keysym)) {
+        i = (i + 1) & mask;
+    }
+    return &bindings->slots[i];
+}
+
+void keybindings_init(struct kaiju_keybindings *bindings) {
+    memset(bindings, 0, sizeof(struct kaiju_keybindings));
+}
+
+void keybindings_finish(struct kaiju_keybindings *bindings) {
+    free(bindings->slots);
+    keybindings_init(bindings);
+}
+
+void keybindings_compile(struct kaiju_keybindings *bindings,
+                         const struct bridge_keybinding *list, size_t count) {
+    keybindings_finish(bindings);
+    if (count == 0) return;
+
+    bindings->capacity = 8;
+    while (bindings->capacity < count * 2) bindings->capacity *= 2;
+    bindings->slots = calloc(bindings->capacity, sizeof(struct kaiju_keybinding));
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t modifiers = list[i].modifiers;
+        xkb_keysym_t keysym = list[i].keysym;
+        keybinding_normalize(&modifiers, &keysym);
+
+        struct kaiju_keybinding *slot = keybindings_slot(bindings, modifiers, keysym);
+        if (slot->used) {
+            fprintf(stderr, "Keybinding %u overrides keybinding %u\n", list[i].id, slot->id);
+        } else {
+            bindings->count++;
+        }
+        *slot = (struct kaiju_keybinding) {
+                .modifiers = modifiers,
+                .keysym = keysym,
+                .id = list[i].id,
+                .used = true,
+        };
+    }
+}
+
+const struct kaiju_keybinding *keybindings_find(const struct kaiju_keybindings *bindings,
+                                                uint32_t modifiers, xkb_keysym_t keysym) {
+    if (bindings->count == 0) return NULL;
+    keybinding_normalize(&modifiers, &keysym);
+    struct kaiju_keybinding *slot = keybindings_slot(bindings, modifiers, keysym);
+    return slot->used ? slot : NULL;
+}
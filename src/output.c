@@ -1,39 +1,332 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <wayland-server-core.h>
 #include <wayland-util.h>
 #include <wlr/backend.h>
 #include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_surface.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_presentation_time.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/util/log.h>
+#include <wlr/util/region.h>
 
+#include "./include/kaiju_input.h"
 #include "./include/kaiju_output.h"
 #include "./include/kaiju_server.h"
+#include "./include/output.h"
 #include "./include/shell/kaiju_view.h"
 
+void output_push_event(struct kaiju_output *output, enum bridge_event_type type) {
+    struct bridge_event record = {
+            .type = type,
+            .time_msec = (uint32_t) (stats_now_nsec() / 1000000),
+            .data.output = {
+                    .id = output->id,
+                    .width = output->wlr_output->width,
+                    .height = output->wlr_output->height,
+                    .refresh = output->wlr_output->refresh,
+            },
+    };
+    event_ring_push(&output->server->event_ring, &record, false);
+}
+
 void output_destroy_notify(struct wl_listener *listener, void *data) {
     struct kaiju_output *output = (struct kaiju_output *) wl_container_of(listener, output, destroy);
+    output_push_event(output, BRIDGE_EVENT_OUTPUT_REMOVE);
+    layout_schedule(output->server);
     wl_list_remove(&output->link);
     wl_list_remove(&output->destroy.link);
     wl_list_remove(&output->frame.link);
-    free(output);
+    wl_list_remove(&output->present.link);
+    wl_event_source_remove(output->repaint_timer);
+    wl_array_release(&output->views);
+    scene_finish(&output->scene);
+    pool_free(&output->server->output_pool, output);
+}
+
+static struct kaiju_view **output_views(struct kaiju_output *output, size_t *count) {
+    /* With several outputs most views are on only one of them, so each
+     * output only walks the views that intersect it. The set changes far
+     * less often than we repaint, so it is only rebuilt when a view was
+     * mapped, moved, resized or restacked, or the output itself moved. */
+    struct kaiju_server *server = output->server;
+    struct wlr_box *box = wlr_output_layout_get_box(server->output_layout, output->wlr_output);
+    struct wlr_box output_box = box != NULL ? *box : (struct wlr_box) {0};
+    if (output->views_serial != server->view_index.serial ||
+        output_box.x != output->views_box.x || output_box.y != output->views_box.y ||
+        output_box.width != output->views_box.width || output_box.height != output->views_box.height) {
+        output->views.size = 0;
+        struct kaiju_view *view;
+        wl_list_for_each(view, &server->views, link) {
+            struct wlr_box intersection;
+            if (!view->mapped || !view->indexed ||
+                !wlr_box_intersection(&intersection, &view->index_box, &output_box)) {
+                continue;
+            }
+            struct kaiju_view **slot = wl_array_add(&output->views, sizeof(struct kaiju_view *));
+            if (slot != NULL) *slot = view;
+        }
+        output->views_serial = server->view_index.serial;
+        output->views_box = output_box;
+    }
+    *count = output->views.size / sizeof(struct kaiju_view *);
+    return output->views.data;
+}
+
+static bool output_update_cursor_plane(struct kaiju_output *output) {
+    /* wlroots falls back to software cursors by itself, e.g. when the image
+     * is too large for the plane or the output is transformed. We only keep
+     * track of it. */
+    struct wlr_output *wlr_output = output->wlr_output;
+    bool hardware = wlr_output->hardware_cursor != NULL && wlr_output->software_cursor_locks == 0;
+    if (hardware != output->hardware_cursor) {
+        wlr_log(WLR_DEBUG, "Output '%s' switched to a %s cursor",
+                wlr_output->name, hardware ? "hardware" : "software");
+        if (!hardware) output->stats.cursor_fallbacks++;
+        output->hardware_cursor = hardware;
+    }
+    return hardware;
+}
+
+void output_damage_surface(struct kaiju_output *output, struct wlr_surface *surface,
+                           double lx, double ly, bool whole) {
+    struct wlr_output *wlr_output = output->wlr_output;
+    double ox = lx, oy = ly;
+    wlr_output_layout_output_coords(output->server->output_layout, wlr_output, &ox, &oy);
+
+    struct wlr_box box = {
+            .x = ox * wlr_output->scale,
+            .y = oy * wlr_output->scale,
+            .width = surface->current.width * wlr_output->scale,
+            .height = surface->current.height * wlr_output->scale,
+    };
+    struct wlr_box output_box = {0};
+    wlr_output_transformed_resolution(wlr_output, &output_box.width, &output_box.height);
+    struct wlr_box intersection;
+    if (!wlr_box_intersection(&intersection, &box, &output_box)) return;
+
+    if (whole) {
+        wlr_output_damage_add_box(output->damage, &box);
+    } else {
+        pixman_region32_t damage;
+        pixman_region32_init(&damage);
+        wlr_surface_get_effective_damage(surface, &damage);
+        wlr_region_scale(&damage, &damage, wlr_output->scale);
+        pixman_region32_translate(&damage, box.x, box.y);
+        wlr_output_damage_add(output->damage, &damage);
+        pixman_region32_fini(&damage);
+    }
+
+    /* A commit may carry no damage at all and only ask for a frame callback.
+     * Make sure we get a frame event anyway so the client isn't left hanging. */
+    wlr_output_schedule_frame(wlr_output);
+}
+
+void server_damage_box(struct kaiju_server *server, struct wlr_box *box) {
+    struct kaiju_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        struct wlr_output *wlr_output = output->wlr_output;
+        double ox = box->x, oy = box->y;
+        wlr_output_layout_output_coords(server->output_layout, wlr_output, &ox, &oy);
+        struct wlr_box output_box = {
+                .x = ox * wlr_output->scale,
+                .y = oy * wlr_output->scale,
+                .width = box->width * wlr_output->scale,
+                .height = box->height * wlr_output->scale,
+        };
+        wlr_output_damage_add_box(output->damage, &output_box);
+    }
+}
+
+static struct kaiju_output *view_primary_output(struct kaiju_view *view) {
+    /* The enabled output which shows the largest part of the view, ties go
+     * to the one that came first */
+    struct kaiju_output *output, *primary = NULL;
+    int primary_area = 0;
+    wl_list_for_each(output, &view->server->outputs, link) {
+        if (!output->wlr_output->enabled) continue;
+        struct wlr_box *box = wlr_output_layout_get_box(view->server->output_layout, output->wlr_output);
+        struct wlr_box intersection;
+        if (box == NULL || !wlr_box_intersection(&intersection, &view->index_box, box)) continue;
+        int area = intersection.width * intersection.height;
+        if (area > primary_area) {
+            primary = output;
+            primary_area = area;
+        }
+    }
+    return primary;
+}
+
+static void view_update_occluded(struct kaiju_output *output, struct kaiju_view *view, bool hidden) {
+    /* A view counts as occluded if nothing of it showed on its primary output
+     * and it isn't on any other output either */
+    if (view_primary_output(view) != output) return;
+    struct wlr_box *box = wlr_output_layout_get_box(output->server->output_layout, output->wlr_output);
+    struct wlr_box *view_box = &view->index_box;
+    view->occluded = hidden && box != NULL &&
+                     view_box->x >= box->x && view_box->y >= box->y &&
+                     view_box->x + view_box->width <= box->x + box->width &&
+                     view_box->y + view_box->height <= box->y + box->height;
+}
+
+static bool surface_output_box(struct wlr_output *output, struct kaiju_view *view,
+                               struct wlr_surface *surface, int sx, int sy, struct wlr_box *box) {
+    /* Computes the box of a surface in output buffer coordinates */
+    double ox = 0, oy = 0;
+    wlr_output_layout_output_coords(
+            view->server->output_layout, output, &ox, &oy);
+    ox += view->props.x + sx, oy += view->props.y + sy;
+
+    box->x = ox * output->scale;
+    box->y = oy * output->scale;
+    box->width = surface->current.width * output->scale;
+    box->height = surface->current.height * output->scale;
+    return box->width > 0 && box->height > 0;
+}
+
+static void scene_node_add_opaque(struct wlr_output *output, struct kaiju_scene_node *node,
+                                  pixman_region32_t *opaque_region) {
+    /* Only surfaces we are actually going to draw can hide anything. */
+    struct wlr_surface *surface = node->surface;
+    if (wlr_surface_get_texture(surface) == NULL) return;
+    struct wlr_box *box = &node->box;
+
+    pixman_region32_t opaque;
+    pixman_region32_init(&opaque);
+    pixman_region32_copy(&opaque, &surface->opaque_region);
+    wlr_region_scale(&opaque, &opaque, output->scale);
+    pixman_region32_translate(&opaque, box->x, box->y);
+    pixman_region32_intersect_rect(&opaque, &opaque, box->x, box->y, box->width, box->height);
+    pixman_region32_union(opaque_region, opaque_region, &opaque);
+    pixman_region32_fini(&opaque);
+}
+
+static void output_compute_visibility(struct kaiju_output *output, pixman_region32_t *opaque) {
+    /* Walks the views front-to-back and works out which part of each view is
+     * not covered by opaque surfaces above it. Surfaces outside of that region
+     * need not be drawn at all. The union of all opaque surfaces is left in
+     * opaque, so that we don't clear the background underneath them either. */
+    struct wlr_output *wlr_output = output->wlr_output;
+    /* Scaling a region rounds outwards, which is fine for damage but would
+     * let opaque regions hide pixels they don't cover with fractional
+     * scales. */
+    bool can_occlude = wlr_output->scale == (int) wlr_output->scale;
+
+    struct kaiju_scene *scene = &output->scene;
+    struct kaiju_scene_view *entries = scene->views.data;
+    struct kaiju_scene_node *nodes = scene->nodes.data;
+    for (size_t i = scene->views.size / sizeof(struct kaiju_scene_view); i-- > 0;) {
+        struct kaiju_scene_view *entry = &entries[i];
+        struct kaiju_view *view = entry->view;
+        pixman_region32_clear(&view->visible);
+        for (size_t j = entry->first; j < entry->first + entry->count; j++) {
+            struct wlr_box *box = &nodes[j].box;
+            pixman_region32_union_rect(&view->visible, &view->visible, box->x, box->y, box->width, box->height);
+        }
+        pixman_region32_subtract(&view->visible, &view->visible, opaque);
+        view_update_occluded(output, view, !pixman_region32_not_empty(&view->visible));
+        if (!can_occlude) continue;
+        for (size_t j = entry->first; j < entry->first + entry->count; j++) {
+            scene_node_add_opaque(wlr_output, &nodes[j], opaque);
+        }
+    }
+}
+
+static void count_surfaces_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    int *count = data;
+    (*count)++;
+}
+
+static bool output_scan_out(struct kaiju_output *output) {
+    /* If a single fullscreen client covers the whole output, we can hand its
+     * buffer straight to the display hardware instead of compositing it. This
+     * saves a full screen copy per frame, which matters for video and games. */
+    struct wlr_output *wlr_output = output->wlr_output;
+    size_t count;
+    struct kaiju_view **views = output_views(output, &count);
+    if (count == 0) return false;
+    struct kaiju_view *top = views[0];
+    if (!top->xdg_surface->toplevel->current.fullscreen) return false;
+
+    /* Popups and subsurfaces would need compositing */
+    int surfaces = 0;
+    wlr_xdg_surface_for_each_surface(top->xdg_surface, count_surfaces_iterator, &surfaces);
+    if (surfaces != 1) return false;
+
+    struct wlr_surface *surface = top->xdg_surface->surface;
+    if (surface->buffer == NULL) return false;
+    if ((float) surface->current.scale != wlr_output->scale ||
+        surface->current.transform != wlr_output->transform) {
+        return false;
+    }
+
+    struct wlr_box box;
+    if (!surface_output_box(wlr_output, top, surface, 0, 0, &box)) return false;
+    if (box.x != 0 || box.y != 0 ||
+        box.width != wlr_output->width || box.height != wlr_output->height) {
+        return false;
+    }
+
+    /* Anything translucent would have to be blended with what is below */
+    pixman_box32_t surface_box = {0, 0, surface->current.width, surface->current.height};
+    if (pixman_region32_contains_rectangle(&surface->opaque_region, &surface_box) != PIXMAN_REGION_IN) {
+        return false;
+    }
+
+    /* The backend decides whether it can actually display the buffer, e.g.
+     * whether the format is supported by the primary plane and no software
+     * cursor needs to be drawn on top of it. */
+    if (!wlr_output_attach_buffer(wlr_output, &surface->buffer->base)) return false;
+    if (!wlr_output_test(wlr_output)) {
+        wlr_output_rollback(wlr_output);
+        return false;
+    }
+    /* Presentation feedback attaches to the output's next commit, so it has
+     * to be set up right before it. Attempts which the backend turned down
+     * leave the surface alone, the composited fallback marks it instead. */
+    wlr_presentation_surface_sampled_on_output(output->server->presentation, surface, wlr_output);
+    return wlr_output_commit(wlr_output);
 }
 
 struct render_data {
     struct wlr_output *output;
     struct wlr_renderer *renderer;
     struct kaiju_view *view;
-    struct timespec *when;
+    pixman_region32_t *damage;
+    /** Collects the quads of the frame, NULL to draw each one right away */
+    struct kaiju_render_batch *batch;
+    struct kaiju_output_stats *stats;
 };
 
-static void render_surface(struct wlr_surface *surface, int sx, int sy, void *data) {
+static void scissor_output(struct wlr_output *output, pixman_box32_t *rect) {
+    /* Damage is tracked in output buffer coordinates, but the renderer expects
+     * the scissor box to be untransformed. */
+    struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+    struct wlr_box box = {
+            .x = rect->x1,
+            .y = rect->y1,
+            .width = rect->x2 - rect->x1,
+            .height = rect->y2 - rect->y1,
+    };
+
+    int ow, oh;
+    wlr_output_transformed_resolution(output, &ow, &oh);
+    enum wl_output_transform transform = wlr_output_transform_invert(output->transform);
+    wlr_box_transform(&box, &box, transform, ow, oh);
+    wlr_renderer_scissor(renderer, &box);
+}
+
+static void render_node(struct render_data *rdata, struct kaiju_scene_node *node) {
     /* This function is called for every surface that needs to be rendered. */
-    struct render_data *rdata = data;
+    struct wlr_surface *surface = node->surface;
     struct kaiju_view *view = rdata->view;
     struct wlr_output *output = rdata->output;
 
@@ -45,107 +338,373 @@ static void render_surface(struct wlr_surface *surface, int sx, int sy, void *da
     struct wlr_texture *texture = wlr_surface_get_texture(surface);
     if (texture == NULL) return;
 
-    /* The view has a position in layout coordinates. If you have two displays,
-     * one next to the other, both 1080p, a view on the rightmost display might
-     * have layout coordinates of 2000,100. We need to translate that to
-     * output-local coordinates, or (2000 - 1920). */
-    double ox = 0, oy = 0;
-    wlr_output_layout_output_coords(
-            view->server->output_layout, output, &ox, &oy);
-    ox += view->props.x + sx, oy += view->props.y + sy;
+    /* Where the surface goes on the output and the matrix to draw it with
+     * were worked out by the scene when it last changed. */
+    struct wlr_box *box = &node->box;
 
-    /* We also have to apply the scale factor for HiDPI outputs. This is only
-     * part of the puzzle, TinyWL does not fully support HiDPI. */
-    struct wlr_box box = {
-            .x = ox * output->scale,
-            .y = oy * output->scale,
-            .width = surface->current.width * output->scale,
-            .height = surface->current.height * output->scale,
-    };
+    /* Only the part of the surface which is both damaged and not hidden
+     * behind opaque views gets drawn. Fully occluded surfaces end up with an
+     * empty region here and are skipped entirely. */
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
+    pixman_region32_union_rect(&damage, &damage, box->x, box->y, box->width, box->height);
+    pixman_region32_intersect(&damage, &damage, &view->visible);
+    if (!pixman_region32_not_empty(&damage)) goto damage_finish;
+
+    /* Whatever the surface last committed is on screen with this frame, even
+     * if none of it had to be redrawn. This lets wlroots send presentation
+     * feedback for it once the frame is actually displayed. */
+    wlr_presentation_surface_sampled_on_output(view->server->presentation, surface, output);
+
+    pixman_region32_intersect(&damage, &damage, rdata->damage);
+    if (!pixman_region32_not_empty(&damage)) goto damage_finish;
+
+    /* Batched quads are drawn together once the frame is complete */
+    if (rdata->batch != NULL &&
+        render_batch_add(rdata->batch, texture, box, surface->current.transform, &damage)) {
+        goto damage_finish;
+    }
 
-    /*
-     * Those familiar with OpenGL are also familiar with the role of matrices
-     * in graphics programming. We need to prepare a matrix to render the view
-     * with. wlr_matrix_project_box is a helper which takes a box with a desired
-     * x, y coordinates, width and height, and an output geometry, then
-     * prepares an orthographic projection and multiplies the necessary
-     * transforms to produce a model-view-projection matrix.
-     *
-     * Naturally you can do this any way you like, for example to make a 3D
-     * compositor.
-     */
-    float matrix[9];
-    enum wl_output_transform transform = wlr_output_transform_invert(surface->current.transform);
-    wlr_matrix_project_box(
-            matrix,
-            &box,
-            transform,
-            0,
-            output->transform_matrix
-    );
+    /* Anything batched so far lies below this surface and has to be drawn
+     * first. */
+    if (rdata->batch != NULL) rdata->stats->draw_calls += render_batch_flush(rdata->batch);
 
     /* This takes our matrix, the texture, and an alpha, and performs the actual
-     * rendering on the GPU. */
-    wlr_render_texture_with_matrix(rdata->renderer, texture, matrix, 1);
+     * rendering on the GPU, once for every damaged rectangle. */
+    int nrects;
+    pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+    for (int i = 0; i < nrects; i++) {
+        scissor_output(output, &rects[i]);
+        wlr_render_texture_with_matrix(rdata->renderer, texture, node->matrix, 1);
+    }
+    rdata->stats->draw_calls += nrects;
+
+damage_finish:
+    pixman_region32_fini(&damage);
+}
+
 
+static void send_frame_done_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
     /* This lets the client know that we've displayed that frame and it can
      * prepare another one now if it likes. */
-    wlr_surface_send_frame_done(surface, rdata->when);
+    wlr_surface_send_frame_done(surface, data);
 }
 
-static void output_frame(struct wl_listener *listener, void *data) {
-    /* This function is called every time an output is ready to display a frame,
-     * generally at the output's refresh rate (e.g. 60Hz). */
-    struct kaiju_output *output = wl_container_of(listener, output, frame);
+static void send_frame_done(struct kaiju_output *output, struct timespec *when) {
+    /* Frame callbacks are sent whether or not we actually had to repaint, as
+     * clients wait on them before drawing their next frame. A view which
+     * spans several outputs would otherwise be woken up by each of them, at
+     * their different rates, so only its primary output paces it. */
+    size_t count;
+    struct kaiju_view **views = output_views(output, &count);
+    for (size_t i = count; i-- > 0;) {
+        struct kaiju_view *view = views[i];
+        /* Hidden views are left to the frame throttle */
+        if (view->occluded || view_primary_output(view) != output) continue;
+        wlr_xdg_surface_for_each_surface(view->xdg_surface, send_frame_done_iterator, when);
+    }
+}
+
+static int frame_throttle_timer(void *data) {
+    /* Views nobody can see still get a frame callback every now and then,
+     * so that they notice e.g. the end of a video, but they are not kept
+     * animating at the full refresh rate. */
+    struct kaiju_server *server = data;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct kaiju_view *view;
+    wl_list_for_each(view, &server->views, link) {
+        if (!view->mapped || (!view->occluded && view_primary_output(view) != NULL)) continue;
+        wlr_xdg_surface_for_each_surface(view->xdg_surface, send_frame_done_iterator, &now);
+    }
+    wl_event_source_timer_update(server->frame_throttle_timer, server->frame_throttle_interval);
+    return 0;
+}
+
+static int frame_throttle_parse_interval(void) {
+    /* KAIJU_HIDDEN_FRAME_RATE is the rate in Hz at which occluded and
+     * offscreen views get frame callbacks, 0 withholds them entirely. */
+    const char *value = getenv("KAIJU_HIDDEN_FRAME_RATE");
+    if (value == NULL) return 1000;
+
+    char *end;
+    long rate = strtol(value, &end, 10);
+    if (*end != '\0' || rate < 0 || rate > 1000) {
+        fprintf(stderr, "Invalid KAIJU_HIDDEN_FRAME_RATE '%s', using 1 Hz\n", value);
+        return 1000;
+    }
+    return rate == 0 ? 0 : (int) (1000 / rate);
+}
+
+void frame_throttle_init(struct kaiju_server *server) {
+    server->frame_throttle_interval = frame_throttle_parse_interval();
+    server->frame_throttle_timer = NULL;
+    if (server->frame_throttle_interval == 0) return;
+    server->frame_throttle_timer = wl_event_loop_add_timer(server->wl_event_loop, frame_throttle_timer, server);
+    wl_event_source_timer_update(server->frame_throttle_timer, server->frame_throttle_interval);
+}
+
+void frame_throttle_finish(struct kaiju_server *server) {
+    if (server->frame_throttle_timer != NULL) {
+        wl_event_source_remove(server->frame_throttle_timer);
+        server->frame_throttle_timer = NULL;
+    }
+}
+
+static void output_update_render_time(struct kaiju_output *output, int64_t sample) {
+    /* Track a decaying peak rather than an average. Underestimating the
+     * render time makes us miss vblank, while overestimating it only costs a
+     * little bit of latency. */
+    if (sample > output->render_time) {
+        output->render_time = sample;
+    } else {
+        output->render_time -= (output->render_time - sample) / 16;
+    }
+}
+
+static int output_repaint(struct kaiju_output *output) {
+    struct wlr_output *wlr_output = output->wlr_output;
     struct wlr_renderer *renderer = output->server->renderer;
 
     struct timespec now;
     clock_gettime(CLOCK_MONOTONIC, &now);
 
-    /* wlr_output_attach_render makes the OpenGL context current. */
-    if (!wlr_output_attach_render(output->wlr_output, NULL)) {
-        return;
+    if (transaction_holds_box(output->server,
+                              wlr_output_layout_get_box(output->server->output_layout, wlr_output))) {
+        /* Keep showing the old layout until every view has caught up. Clients
+         * still got their frame callbacks in output_frame, as some only draw
+         * the new size on their next frame. Outputs the transaction doesn't
+         * touch carry on as usual. */
+        return 0;
     }
-    /* The "effective" resolution can change if you rotate your outputs. */
-    int width, height;
-    wlr_output_effective_resolution(output->wlr_output, &width, &height);
-    /* Begin the renderer (calls glViewport and some other GL sanity checks) */
-    wlr_renderer_begin(renderer, width, height);
 
-    float color[4] = {0.3, 0.3, 0.3, 1.0};
-    wlr_renderer_clear(renderer, color);
+    bool needs_frame;
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
 
-    /* Each subsequent window we render is rendered on top of the last. Because
-     * our view list is ordered front-to-back, we iterate over it backwards. */
-    struct kaiju_view *view;
-    wl_list_for_each_reverse(view, &output->server->views, link) {
-        if (!view->mapped) {
-            /* An unmapped view should not be rendered. */
-            continue;
+    if (output_scan_out(output)) {
+        if (!output->scanned_out) {
+            wlr_log(WLR_DEBUG, "Direct scanout started on output '%s'", wlr_output->name);
+        }
+        output->scanned_out = true;
+        output->stats.scanout_frames++;
+        /* The fullscreen view on top covers everything below it */
+        size_t count;
+        struct kaiju_view **views = output_views(output, &count);
+        for (size_t i = 0; i < count; i++) {
+            view_update_occluded(output, views[i], i > 0);
         }
+        output_stats_commit(&output->stats);
+        goto frame_done;
+    }
+    if (output->scanned_out) {
+        /* Our own buffers have not been drawn to while the client's buffer was
+         * on screen, so their contents can't be trusted anymore. */
+        wlr_log(WLR_DEBUG, "Direct scanout stopped on output '%s' (%lu frames scanned out)",
+                wlr_output->name, (unsigned long) output->stats.scanout_frames);
+        output->scanned_out = false;
+        wlr_output_damage_add_whole(output->damage);
+    }
+
+    /* wlr_output_damage_attach_render makes the OpenGL context current, and
+     * tells us which part of the buffer is out of date. */
+    if (!wlr_output_damage_attach_render(output->damage, &needs_frame, &damage)) {
+        goto damage_finish;
+    }
+    if (!needs_frame) {
+        /* Nothing changed since the last frame, so there is nothing to draw. */
+        wlr_output_rollback(wlr_output);
+        goto frame_done;
+    }
+
+    /* Begin the renderer (calls glViewport and some other GL sanity checks).
+     * Damage is in buffer coordinates, so we use the buffer size here. */
+    wlr_renderer_begin(renderer, wlr_output->width, wlr_output->height);
+    if (!pixman_region32_not_empty(&damage)) {
+        /* The buffer is up to date, but the output still wants a commit. */
+        goto renderer_end;
+    }
+
+    size_t count;
+    struct kaiju_view **views = output_views(output, &count);
+    scene_update(output, views, count);
+
+    pixman_region32_t background;
+    pixman_region32_init(&background);
+    output_compute_visibility(output, &background);
+    /* The background only shows where no opaque surface covers it */
+    pixman_region32_subtract(&background, &damage, &background);
+
+    float color[4] = {0.3, 0.3, 0.3, 1.0};
+    int nrects;
+    pixman_box32_t *rects = pixman_region32_rectangles(&background, &nrects);
+    for (int i = 0; i < nrects; i++) {
+        scissor_output(wlr_output, &rects[i]);
+        wlr_renderer_clear(renderer, color);
+    }
+    pixman_region32_fini(&background);
+
+    /* Surfaces are collected into a single GL submission where the renderer
+     * allows, see render_batch.h. */
+    struct kaiju_render_batch *batch = &output->server->render_batch;
+    if (render_batch_begin(batch, renderer, wlr_output)) {
+        output->stats.batched_frames++;
+    } else {
+        batch = NULL;
+    }
+
+    /* Each subsequent window we render is rendered on top of the last. The
+     * scene holds the views bottom to top, each with the nodes of its
+     * toplevel, subsurfaces and popups in drawing order. Views which are not
+     * on this output at all are not in it. */
+    struct kaiju_scene *scene = &output->scene;
+    struct kaiju_scene_view *entries = scene->views.data;
+    struct kaiju_scene_node *nodes = scene->nodes.data;
+    for (size_t i = 0; i < scene->views.size / sizeof(struct kaiju_scene_view); i++) {
         struct render_data rdata = {
-                .output = output->wlr_output,
-                .view = view,
+                .output = wlr_output,
+                .view = entries[i].view,
                 .renderer = renderer,
-                .when = &now,
+                .damage = &damage,
+                .batch = batch,
+                .stats = &output->stats,
         };
-        /* This calls our render_surface function for each surface among the
-         * xdg_surface's toplevel and popups. */
-        wlr_xdg_surface_for_each_surface(view->xdg_surface, render_surface, &rdata);
+        for (size_t j = entries[i].first; j < entries[i].first + entries[i].count; j++) {
+            render_node(&rdata, &nodes[j]);
+        }
     }
+    if (batch != NULL) output->stats.draw_calls += render_batch_flush(batch);
 
     /* Hardware cursors are rendered by the GPU on a separate plane, and can be
      * moved around without re-rendering what's beneath them - which is more
      * efficient. However, not all hardware supports hardware cursors. For this
      * reason, wlroots provides a software fallback, which we ask it to render
      * here. wlr_cursor handles configuring hardware vs software cursors for you,
-     * and this function is a no-op when hardware cursors are in use. */
-    wlr_output_render_software_cursors(output->wlr_output, NULL);
+     * and this function is a no-op when hardware cursors are in use. Only the
+     * damaged part is drawn, wlroots damages wherever the cursor moved. */
+    if (!output_update_cursor_plane(output)) {
+        output->stats.software_cursor_frames++;
+        wlr_output_render_software_cursors(wlr_output, &damage);
+    }
 
+renderer_end:
     /* Conclude rendering and swap the buffers, showing the final frame
-     * on-screen. */
+     * on-screen. Only the damaged part of the frame is submitted. */
+    wlr_renderer_scissor(renderer, NULL);
     wlr_renderer_end(renderer);
-    wlr_output_commit(output->wlr_output);
+
+    int width, height;
+    wlr_output_transformed_resolution(wlr_output, &width, &height);
+    pixman_region32_t frame_damage;
+    pixman_region32_init(&frame_damage);
+    enum wl_output_transform transform = wlr_output_transform_invert(wlr_output->transform);
+    wlr_region_transform(&frame_damage, &output->damage->current, transform, width, height);
+    wlr_output_set_damage(wlr_output, &frame_damage);
+    pixman_region32_fini(&frame_damage);
+
+    if (wlr_output_commit(wlr_output)) {
+        output_stats_commit(&output->stats);
+    }
+
+frame_done:
+    if (!output->server->first_frame_shown && output->stats.frames > 0) {
+        output->server->first_frame_shown = true;
+        stats_startup_mark(output->server, "first frame");
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int64_t repaint_time = timespec_to_nsec(&end) - timespec_to_nsec(&now);
+    output_update_render_time(output, repaint_time);
+    histogram_add(&output->stats.render_time, repaint_time);
+
+damage_finish:
+    pixman_region32_fini(&damage);
+    return 0;
+}
+
+static int output_repaint_timer(void *data) {
+    struct kaiju_output *output = data;
+    return output_repaint(output);
+}
+
+static int output_render_delay(struct kaiju_output *output) {
+    /* Works out how long we can wait before rendering and still make the next
+     * vblank. Rendering as late as possible lets client commits which arrive
+     * in the meantime make it into this frame instead of the next one. */
+    struct wlr_output *wlr_output = output->wlr_output;
+    if (output->max_render_time == 0 || wlr_output->refresh <= 0) return 0;
+
+    int64_t budget;
+    if (output->max_render_time == KAIJU_RENDER_TIME_AUTO) {
+        /* Leave some headroom for the scheduler waking us up late */
+        budget = output->render_time * 3 / 2 + 1000000;
+    } else {
+        budget = (int64_t) output->max_render_time * 1000000;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t now_ns = timespec_to_nsec(&now);
+    int64_t refresh_ns = 1000000000000LL / wlr_output->refresh;
+    int64_t next_vblank = timespec_to_nsec(&output->last_frame) + refresh_ns;
+    if (next_vblank <= now_ns) {
+        /* We missed a few presentation events, e.g. because nothing was
+         * committed for a while. Predict the next vblank from the last one. */
+        next_vblank += ((now_ns - next_vblank) / refresh_ns + 1) * refresh_ns;
+    }
+
+    int64_t delay = next_vblank - budget - now_ns;
+    /* Timers only have millisecond precision, so anything less is not worth
+     * the wakeup. */
+    return delay < 1000000 ? 0 : (int) (delay / 1000000);
+}
+
+static void output_frame(struct wl_listener *listener, void *data) {
+    /* This function is called every time an output is ready to display a frame,
+     * generally at the output's refresh rate (e.g. 60Hz). */
+    struct kaiju_output *output = wl_container_of(listener, output, frame);
+
+    int delay = output_render_delay(output);
+    if (delay == 0) {
+        output_repaint(output);
+    } else {
+        wl_event_source_timer_update(output->repaint_timer, delay);
+    }
+
+    /* Clients are told to draw as soon as the frame event arrives rather than
+     * after the delayed repaint, so that what they commit in the meantime
+     * still makes it into this frame. */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    send_frame_done(output, &now);
+}
+
+static void output_present(struct wl_listener *listener, void *data) {
+    /* Raised when a frame we committed actually made it on screen. This is
+     * what the frame scheduler predicts the next vblank from. */
+    struct kaiju_output *output = wl_container_of(listener, output, present);
+    struct wlr_output_event_present *event = data;
+    if (event->when != NULL) {
+        output->last_frame = *event->when;
+        output_stats_present(&output->stats, event->when, event->refresh);
+    }
+}
+
+static int output_parse_max_render_time(void) {
+    /* KAIJU_MAX_RENDER_TIME is either a number of milliseconds, "auto" to
+     * adapt to measured render times or "off" to render right away. */
+    const char *value = getenv("KAIJU_MAX_RENDER_TIME");
+    if (value == NULL || strcmp(value, "off") == 0) return 0;
+    if (strcmp(value, "auto") == 0) return KAIJU_RENDER_TIME_AUTO;
+
+    char *end;
+    long max_render_time = strtol(value, &end, 10);
+    if (*end != '\0' || max_render_time < 0) {
+        fprintf(stderr, "Invalid KAIJU_MAX_RENDER_TIME '%s', rendering without delay\n", value);
+        return 0;
+    }
+    return (int) max_render_time;
 }
 
 void new_output_notify(struct wl_listener *listener, void *data) {
@@ -158,10 +717,13 @@ void new_output_notify(struct wl_listener *listener, void *data) {
         wlr_output_set_mode(wlr_output, mode);
     }
 
-    struct kaiju_output *output = (struct kaiju_output *) calloc(1, sizeof(struct kaiju_output));
+    struct kaiju_output *output = (struct kaiju_output *) pool_alloc(&server->output_pool);
     clock_gettime(CLOCK_MONOTONIC, &output->last_frame);
     output->server = server;
+    output->id = ++server->last_output_id;
     output->wlr_output = wlr_output;
+    wl_array_init(&output->views);
+    scene_init(&output->scene);
     wl_list_insert(&server->outputs, &output->link);
 
     /* Adds this to the output layout. The add_auto function arranges outputs
@@ -169,9 +731,25 @@ void new_output_notify(struct wl_listener *listener, void *data) {
 	 * compositor would let the user configure the arrangement of outputs in the
 	 * layout. */
     wlr_output_layout_add_auto(server->output_layout, wlr_output);
+    /* The cursor on the new output starts out without an image */
+    cursor_refresh_image(server);
 
+    /* The destroy listener has to be added before the damage tracker is
+     * created, so that we unhook our frame listener before it is freed. */
     output->destroy.notify = output_destroy_notify;
     wl_signal_add(&wlr_output->events.destroy, &output->destroy);
+
+    /* Frames are driven by the damage tracker rather than the output itself,
+     * which lets us skip them whenever nothing changed on screen. */
+    output->damage = wlr_output_damage_create(wlr_output);
     output->frame.notify = output_frame;
-    wl_signal_add(&wlr_output->events.frame, &output->frame);
+    wl_signal_add(&output->damage->events.frame, &output->frame);
+
+    output->max_render_time = output_parse_max_render_time();
+    output->repaint_timer = wl_event_loop_add_timer(server->wl_event_loop, output_repaint_timer, output);
+    output->present.notify = output_present;
+    wl_signal_add(&wlr_output->events.present, &output->present);
+
+    output_push_event(output, BRIDGE_EVENT_OUTPUT_ADD);
+    layout_schedule(server);
 }
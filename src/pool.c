@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+#include "./include/pool.h"
+
+#define POOL_POISON 0xa5
+
+struct kaiju_pool_slab {
+    struct kaiju_pool_slab *next;
+    /* Aligned for any object we might store */
+    max_align_t data[];
+};
+
+void pool_init(struct kaiju_pool *pool, const char *name, size_t object_size) {
+    memset(pool, 0, sizeof(struct kaiju_pool));
+    pool->name = name;
+    /* Free slots store the free list link in their first bytes, and every
+     * slot has to stay aligned. */
+    if (object_size < sizeof(void *)) object_size = sizeof(void *);
+    pool->object_size = (object_size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+
+    const char *debug = getenv("KAIJU_POOL_DEBUG");
+    pool->poison = debug != NULL && strcmp(debug, "1") == 0;
+}
+
+void pool_finish(struct kaiju_pool *pool) {
+    struct kaiju_pool_slab *slab = pool->slabs;
+    while (slab != NULL) {
+        struct kaiju_pool_slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->fresh = NULL;
+    pool->fresh_left = 0;
+}
+
+static void pool_poison(struct kaiju_pool *pool, void *object) {
+    memset((char *) object + sizeof(void *), POOL_POISON, pool->object_size - sizeof(void *));
+}
+
+static void pool_check_poison(struct kaiju_pool *pool, void *object) {
+    unsigned char *bytes = object;
+    for (size_t i = sizeof(void *); i < pool->object_size; i++) {
+        if (bytes[i] == POOL_POISON) continue;
+        fprintf(stderr, "Pool '%s': object %p was written to after being freed (offset %zu)\n",
+                pool->name, object, i);
+        abort();
+    }
+}
+
+static bool pool_grow(struct kaiju_pool *pool) {
+    struct kaiju_pool_slab *slab = malloc(sizeof(struct kaiju_pool_slab) +
+                                          pool->object_size * KAIJU_POOL_SLAB_OBJECTS);
+    if (slab == NULL) return false;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->fresh = (char *) slab->data;
+    pool->fresh_left = KAIJU_POOL_SLAB_OBJECTS;
+    pool->stats.capacity += KAIJU_POOL_SLAB_OBJECTS;
+    return true;
+}
+
+void *pool_alloc(struct kaiju_pool *pool) {
+    void *object;
+    if (pool->free_list != NULL) {
+        /* Recently freed slots are preferred, they are likely still cached */
+        object = pool->free_list;
+        pool->free_list = *(void **) object;
+        if (pool->poison) pool_check_poison(pool, object);
+        pool->stats.reuses++;
+    } else {
+        if (pool->fresh_left == 0 && !pool_grow(pool)) return NULL;
+        object = pool->fresh;
+        pool->fresh += pool->object_size;
+        pool->fresh_left--;
+    }
+    memset(object, 0, pool->object_size);
+
+    pool->stats.allocations++;
+    pool->stats.live++;
+    if (pool->stats.live > pool->stats.peak) pool->stats.peak = pool->stats.live;
+    return object;
+}
+
+void pool_free(struct kaiju_pool *pool, void *object) {
+    if (object == NULL) return;
+    if (pool->poison) pool_poison(pool, object);
+    *(void **) object = pool->free_list;
+    pool->free_list = object;
+
+    pool->stats.frees++;
+    pool->stats.live--;
+}
+
+void pool_print_stats(struct kaiju_pool *pool, FILE *file) {
+    struct kaiju_pool_stats *stats = &pool->stats;
+    fprintf(file, "Pool '%s': %zu live, %zu peak, %zu slots, %llu allocations (%llu reused), %llu frees\n",
+            pool->name, stats->live, stats->peak, stats->capacity,
+            (unsigned long long) stats->allocations,
+            (unsigned long long) stats->reuses,
+            (unsigned long long) stats->frees);
+}
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <wlr/render/egl.h>
+#include <wlr/render/gles2.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_matrix.h>
+
+#include "./include/render_batch.h"
+
+#define BATCH_ATTRIB_POS 0
+#define BATCH_ATTRIB_TEXCOORD 1
+
+enum batch_shader {
+    BATCH_SHADER_RGBA,
+    BATCH_SHADER_RGBX,
+    BATCH_SHADER_EXTERNAL,
+};
+
+struct batch_draw {
+    enum batch_shader shader;
+    GLenum target;
+    GLuint tex;
+    GLint first;
+    GLsizei count;
+};
+
+static const GLchar batch_vertex_src[] =
+        "uniform mat3 proj;\n"
+        "attribute vec2 pos;\n"
+        "attribute vec2 texcoord;\n"
+        "varying vec2 v_texcoord;\n"
+        "void main() {\n"
+        "    gl_Position = vec4(proj * vec3(pos, 1.0), 1.0);\n"
+        "    v_texcoord = texcoord;\n"
+        "}\n";
+
+static const GLchar batch_rgba_src[] =
+        "precision mediump float;\n"
+        "varying vec2 v_texcoord;\n"
+        "uniform sampler2D tex;\n"
+        "void main() {\n"
+        "    gl_FragColor = texture2D(tex, v_texcoord);\n"
+        "}\n";
+
+static const GLchar batch_rgbx_src[] =
+        "precision mediump float;\n"
+        "varying vec2 v_texcoord;\n"
+        "uniform sampler2D tex;\n"
+        "void main() {\n"
+        "    gl_FragColor = vec4(texture2D(tex, v_texcoord).rgb, 1.0);\n"
+        "}\n";
+
+static const GLchar batch_external_src[] =
+        "#extension GL_OES_EGL_image_external : require\n"
+        "precision mediump float;\n"
+        "varying vec2 v_texcoord;\n"
+        "uniform samplerExternalOES tex;\n"
+        "void main() {\n"
+        "    gl_FragColor = texture2D(tex, v_texcoord);\n"
+        "}\n";
+
+static GLuint batch_compile_shader(GLenum type, const GLchar *src) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+
+    GLint ok;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (ok == GL_FALSE) {
+        char log[512];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "Failed to compile batch shader: %s\n", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+static GLuint batch_link_program(const GLchar *frag_src) {
+    GLuint vert = batch_compile_shader(GL_VERTEX_SHADER, batch_vertex_src);
+    if (vert == 0) return 0;
+    GLuint frag = batch_compile_shader(GL_FRAGMENT_SHADER, frag_src);
+    if (frag == 0) {
+        glDeleteShader(vert);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vert);
+    glAttachShader(program, frag);
+    /* All programs share the same attribute locations, so the vertex buffer
+     * only has to be set up once per flush. */
+    glBindAttribLocation(program, BATCH_ATTRIB_POS, "pos");
+    glBindAttribLocation(program, BATCH_ATTRIB_TEXCOORD, "texcoord");
+    glLinkProgram(program);
+    glDetachShader(program, vert);
+    glDetachShader(program, frag);
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+
+    GLint ok;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (ok == GL_FALSE) {
+        char log[512];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        fprintf(stderr, "Failed to link batch shader: %s\n", log);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static bool batch_init_gl(struct kaiju_render_batch *batch) {
+    static const GLchar *sources[KAIJU_BATCH_SHADERS] = {
+            [BATCH_SHADER_RGBA] = batch_rgba_src,
+            [BATCH_SHADER_RGBX] = batch_rgbx_src,
+            [BATCH_SHADER_EXTERNAL] = batch_external_src,
+    };
+
+    batch->initialized = true;
+    for (int i = 0; i < KAIJU_BATCH_SHADERS; i++) {
+        struct kaiju_batch_shader *shader = &batch->shaders[i];
+        shader->program = batch_link_program(sources[i]);
+        if (shader->program == 0) continue;
+        shader->proj = glGetUniformLocation(shader->program, "proj");
+        shader->tex = glGetUniformLocation(shader->program, "tex");
+    }
+
+    /* External textures are only used by some dmabuf imports, the plain
+     * shaders are what nearly every frame needs. */
+    if (batch->shaders[BATCH_SHADER_RGBA].program == 0 ||
+        batch->shaders[BATCH_SHADER_RGBX].program == 0) {
+        fprintf(stderr, "Falling back to drawing surfaces one by one\n");
+        batch->enabled = false;
+        return false;
+    }
+    glGenBuffers(1, &batch->vbo);
+    return true;
+}
+
+void render_batch_init(struct kaiju_render_batch *batch) {
+    memset(batch, 0, sizeof(struct kaiju_render_batch));
+    const char *env = getenv("KAIJU_RENDER_BATCH");
+    batch->enabled = env == NULL || strcmp(env, "0") != 0;
+    wl_array_init(&batch->vertices);
+    wl_array_init(&batch->draws);
+}
+
+void render_batch_finish(struct kaiju_render_batch *batch) {
+    if (batch->initialized && batch->renderer != NULL) {
+        /* GL objects can only be deleted with the renderer's context current */
+        wlr_egl_make_current(wlr_gles2_renderer_get_egl(batch->renderer), EGL_NO_SURFACE, NULL);
+        for (int i = 0; i < KAIJU_BATCH_SHADERS; i++) {
+            if (batch->shaders[i].program != 0) glDeleteProgram(batch->shaders[i].program);
+        }
+        if (batch->vbo != 0) glDeleteBuffers(1, &batch->vbo);
+    }
+    wl_array_release(&batch->vertices);
+    wl_array_release(&batch->draws);
+    batch->initialized = false;
+    batch->renderer = NULL;
+}
+
+bool render_batch_begin(struct kaiju_render_batch *batch, struct wlr_renderer *renderer,
+                        struct wlr_output *output) {
+    if (!batch->enabled) return false;
+    if (!wlr_renderer_is_gles2(renderer)) {
+        batch->enabled = false;
+        return false;
+    }
+    batch->renderer = renderer;
+    if (!batch->initialized && !batch_init_gl(batch)) return false;
+
+    /* Same projection as the GLES2 renderer sets up in wlr_renderer_begin,
+     * so that vertices can be given in output buffer coordinates. */
+    float projection[9], matrix[9];
+    wlr_matrix_projection(projection, output->width, output->height, WL_OUTPUT_TRANSFORM_FLIPPED_180);
+    wlr_matrix_multiply(matrix, projection, output->transform_matrix);
+    wlr_matrix_transpose(batch->projection, matrix);
+
+    batch->vertices.size = 0;
+    batch->draws.size = 0;
+    return true;
+}
+
+bool render_batch_add(struct kaiju_render_batch *batch, struct wlr_texture *texture,
+                      const struct wlr_box *box, enum wl_output_transform transform,
+                      pixman_region32_t *region) {
+    if (transform != WL_OUTPUT_TRANSFORM_NORMAL || !wlr_texture_is_gles2(texture)) return false;
+
+    struct wlr_gles2_texture_attribs attribs;
+    wlr_gles2_texture_get_attribs(texture, &attribs);
+    enum batch_shader shader;
+    if (attribs.target == GL_TEXTURE_EXTERNAL_OES) {
+        shader = BATCH_SHADER_EXTERNAL;
+    } else {
+        shader = attribs.has_alpha ? BATCH_SHADER_RGBA : BATCH_SHADER_RGBX;
+    }
+    if (batch->shaders[shader].program == 0) return false;
+
+    int nrects;
+    pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+    if (nrects == 0) return true;
+
+    GLint first = batch->vertices.size / (4 * sizeof(float));
+    float *vertices = wl_array_add(&batch->vertices, (size_t) nrects * 6 * 4 * sizeof(float));
+    if (vertices == NULL) return false;
+
+    /* Two triangles per damaged rectangle, clipped here rather than with a
+     * scissor, with texture coordinates matching the clipped part. */
+    for (int i = 0; i < nrects; i++) {
+        float x1 = rects[i].x1, y1 = rects[i].y1, x2 = rects[i].x2, y2 = rects[i].y2;
+        float u1 = (x1 - box->x) / box->width, u2 = (x2 - box->x) / box->width;
+        float v1 = (y1 - box->y) / box->height, v2 = (y2 - box->y) / box->height;
+        if (attribs.inverted_y) {
+            v1 = 1 - v1;
+            v2 = 1 - v2;
+        }
+        float quad[6][4] = {
+                {x1, y1, u1, v1}, {x2, y1, u2, v1}, {x1, y2, u1, v2},
+                {x2, y1, u2, v1}, {x2, y2, u2, v2}, {x1, y2, u1, v2},
+        };
+        memcpy(vertices, quad, sizeof(quad));
+        vertices += 6 * 4;
+    }
+
+    /* Subsurfaces and popups of the same buffer, and several rectangles of
+     * the same surface, end up in the same draw. */
+    GLsizei count = nrects * 6;
+    size_t ndraws = batch->draws.size / sizeof(struct batch_draw);
+    struct batch_draw *last = ndraws > 0 ? &((struct batch_draw *) batch->draws.data)[ndraws - 1] : NULL;
+    if (last != NULL && last->tex == attribs.tex && last->target == attribs.target &&
+        last->first + last->count == first) {
+        last->count += count;
+        return true;
+    }
+
+    struct batch_draw *draw = wl_array_add(&batch->draws, sizeof(struct batch_draw));
+    if (draw == NULL) {
+        batch->vertices.size -= (size_t) count * 4 * sizeof(float);
+        return false;
+    }
+    *draw = (struct batch_draw) {
+            .shader = shader,
+            .target = attribs.target,
+            .tex = attribs.tex,
+            .first = first,
+            .count = count,
+    };
+    return true;
+}
+
+unsigned int render_batch_flush(struct kaiju_render_batch *batch) {
+    size_t ndraws = batch->draws.size / sizeof(struct batch_draw);
+    if (ndraws == 0) return 0;
+
+    /* Quads are already clipped, a scissor left over from the per-surface
+     * path would only cut them further. */
+    wlr_renderer_scissor(batch->renderer, NULL);
+
+    glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+    glBufferData(GL_ARRAY_BUFFER, batch->vertices.size, batch->vertices.data, GL_STREAM_DRAW);
+    glVertexAttribPointer(BATCH_ATTRIB_POS, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *) 0);
+    glVertexAttribPointer(BATCH_ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float),
+                          (void *) (2 * sizeof(float)));
+    glEnableVertexAttribArray(BATCH_ATTRIB_POS);
+    glEnableVertexAttribArray(BATCH_ATTRIB_TEXCOORD);
+    glActiveTexture(GL_TEXTURE0);
+
+    /* Draws stay in painter's order, the program only changes when the kind
+     * of texture does. */
+    struct batch_draw *draws = batch->draws.data;
+    int current = -1;
+    for (size_t i = 0; i < ndraws; i++) {
+        struct batch_draw *draw = &draws[i];
+        if ((int) draw->shader != current) {
+            struct kaiju_batch_shader *shader = &batch->shaders[draw->shader];
+            glUseProgram(shader->program);
+            glUniformMatrix3fv(shader->proj, 1, GL_FALSE, batch->projection);
+            glUniform1i(shader->tex, 0);
+            current = draw->shader;
+        }
+        glBindTexture(draw->target, draw->tex);
+        glTexParameteri(draw->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(draw->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glDrawArrays(GL_TRIANGLES, draw->first, draw->count);
+        glBindTexture(draw->target, 0);
+    }
+
+    /* wlroots draws from client memory and doesn't expect a bound buffer */
+    glDisableVertexAttribArray(BATCH_ATTRIB_POS);
+    glDisableVertexAttribArray(BATCH_ATTRIB_TEXCOORD);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    batch->vertices.size = 0;
+    batch->draws.size = 0;
+    return ndraws;
+}
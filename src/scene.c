@@ -0,0 +1,148 @@
+#include <string.h>
+#include <wayland-util.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_xdg_shell.h>
+
+#include "./include/kaiju_output.h"
+#include "./include/kaiju_server.h"
+#include "./include/scene.h"
+#include "./include/shell/kaiju_view.h"
+
+void scene_init(struct kaiju_scene *scene) {
+    memset(scene, 0, sizeof(struct kaiju_scene));
+    wl_array_init(&scene->views);
+    wl_array_init(&scene->nodes);
+    wl_array_init(&scene->old_views);
+    wl_array_init(&scene->old_nodes);
+}
+
+void scene_finish(struct kaiju_scene *scene) {
+    wl_array_release(&scene->views);
+    wl_array_release(&scene->nodes);
+    wl_array_release(&scene->old_views);
+    wl_array_release(&scene->old_nodes);
+}
+
+struct scene_build_data {
+    struct kaiju_scene *scene;
+    struct wlr_output *output;
+    struct kaiju_view *view;
+};
+
+static void scene_node_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    /* The view has a position in layout coordinates. If you have two displays,
+     * one next to the other, both 1080p, a view on the rightmost display might
+     * have layout coordinates of 2000,100. We need to translate that to
+     * output-local coordinates, or (2000 - 1920), and apply the scale factor
+     * for HiDPI outputs. */
+    struct scene_build_data *bdata = data;
+    struct kaiju_scene *scene = bdata->scene;
+    struct wlr_output *output = bdata->output;
+    double ox = bdata->view->props.x + sx - scene->output_box.x;
+    double oy = bdata->view->props.y + sy - scene->output_box.y;
+    struct wlr_box box = {
+            .x = ox * output->scale,
+            .y = oy * output->scale,
+            .width = surface->current.width * output->scale,
+            .height = surface->current.height * output->scale,
+    };
+    if (box.width <= 0 || box.height <= 0) return;
+
+    struct kaiju_scene_node *node = wl_array_add(&scene->nodes, sizeof(struct kaiju_scene_node));
+    if (node == NULL) return;
+    node->surface = surface;
+    node->box = box;
+    /* wlr_matrix_project_box takes the box and the output's projection and
+     * produces the model-view-projection matrix to render the texture with. */
+    enum wl_output_transform transform = wlr_output_transform_invert(surface->current.transform);
+    wlr_matrix_project_box(node->matrix, &box, transform, 0, output->transform_matrix);
+}
+
+static bool scene_view_current(struct kaiju_scene_view *entry, struct kaiju_view *view) {
+    return entry->view == view && entry->serial == view->scene_serial &&
+           entry->x == view->props.x && entry->y == view->props.y;
+}
+
+static bool scene_output_changed(struct kaiju_scene *scene, struct wlr_output *output, struct wlr_box *box) {
+    return box->x != scene->output_box.x || box->y != scene->output_box.y ||
+           box->width != scene->output_box.width || box->height != scene->output_box.height ||
+           output->scale != scene->scale || output->transform != scene->transform ||
+           output->width != scene->width || output->height != scene->height;
+}
+
+void scene_update(struct kaiju_output *output, struct kaiju_view **views, size_t count) {
+    struct kaiju_scene *scene = &output->scene;
+    struct wlr_output *wlr_output = output->wlr_output;
+    struct wlr_box *layout_box = wlr_output_layout_get_box(output->server->output_layout, wlr_output);
+    struct wlr_box output_box = layout_box != NULL ? *layout_box : (struct wlr_box) {0};
+
+    struct kaiju_scene_view *entries = scene->views.data;
+    size_t entries_len = scene->views.size / sizeof(struct kaiju_scene_view);
+    if (scene_output_changed(scene, wlr_output, &output_box)) {
+        /* Every node moves along with the output */
+        entries_len = 0;
+        scene->output_box = output_box;
+        scene->scale = wlr_output->scale;
+        scene->transform = wlr_output->transform;
+        scene->width = wlr_output->width;
+        scene->height = wlr_output->height;
+    } else if (entries_len == count) {
+        bool current = true;
+        for (size_t i = 0; i < count && current; i++) {
+            current = scene_view_current(&entries[i], views[count - i - 1]);
+        }
+        if (current) return;
+    }
+
+    /* Start over on the spare arrays, and copy whatever is still good */
+    struct wl_array swap = scene->old_views;
+    scene->old_views = scene->views;
+    scene->views = swap;
+    swap = scene->old_nodes;
+    scene->old_nodes = scene->nodes;
+    scene->nodes = swap;
+    scene->views.size = 0;
+    scene->nodes.size = 0;
+    struct kaiju_scene_node *old_nodes = scene->old_nodes.data;
+
+    size_t hint = 0;
+    for (size_t i = count; i-- > 0;) {
+        struct kaiju_view *view = views[i];
+        struct kaiju_scene_view *old = NULL;
+        /* Views mostly keep their order, so the next entry usually matches */
+        for (size_t j = 0; j < entries_len && old == NULL; j++) {
+            struct kaiju_scene_view *entry = &entries[(hint + j) % entries_len];
+            if (scene_view_current(entry, view)) {
+                old = entry;
+                hint = (hint + j + 1) % entries_len;
+            }
+        }
+
+        struct kaiju_scene_view *entry = wl_array_add(&scene->views, sizeof(struct kaiju_scene_view));
+        if (entry == NULL) return;
+        *entry = (struct kaiju_scene_view) {
+                .view = view,
+                .serial = view->scene_serial,
+                .x = view->props.x,
+                .y = view->props.y,
+                .first = scene->nodes.size / sizeof(struct kaiju_scene_node),
+        };
+
+        if (old != NULL) {
+            struct kaiju_scene_node *nodes = wl_array_add(&scene->nodes, old->count * sizeof(struct kaiju_scene_node));
+            if (nodes != NULL) memcpy(nodes, &old_nodes[old->first], old->count * sizeof(struct kaiju_scene_node));
+            output->stats.scene_reuses++;
+        } else {
+            struct scene_build_data bdata = {
+                    .scene = scene,
+                    .output = wlr_output,
+                    .view = view,
+            };
+            wlr_xdg_surface_for_each_surface(view->xdg_surface, scene_node_iterator, &bdata);
+            output->stats.scene_builds++;
+        }
+        entry->count = scene->nodes.size / sizeof(struct kaiju_scene_node) - entry->first;
+    }
+}
@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wayland-server-core.h>
+#include <wayland-util.h>
+#include <wlr/backend.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/types/wlr_gamma_control_v1.h>
+#include <wlr/types/wlr_idle.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_presentation_time.h>
+#include <wlr/types/wlr_primary_selection_v1.h>
+#include <wlr/types/wlr_screencopy_v1.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_data_device.h>
+
+#include "./kaiju_output.h"
+#include "./kaiju_server.h"
+#include "./shell/kaiju_view.h"
+#include "./shell/xdg.h"
+#include "./output.h"
+#include "./include/kaiju_input.h"
+#include "./include/bridge/hooks.h"
+
+void server_init(struct kaiju_server *server, struct wl_display *display, struct wlr_backend *backend) {
+    pool_init(&server->view_pool, "views", sizeof(struct kaiju_view));
+    pool_init(&server->popup_pool, "popups", sizeof(struct kaiju_popup));
+    pool_init(&server->subsurface_pool, "subsurfaces", sizeof(struct kaiju_subsurface));
+    pool_init(&server->output_pool, "outputs", sizeof(struct kaiju_output));
+    pool_init(&server->surface_pool, "surfaces", sizeof(struct kaiju_surface_upload));
+
+    server->wl_display = display;
+    server->wl_event_loop = wl_display_get_event_loop(server->wl_display);
+    assert(server->wl_event_loop);
+    server->backend = backend;
+
+    server->renderer = wlr_backend_get_renderer(server->backend);
+    wlr_renderer_init_wl_display(server->renderer, server->wl_display);
+    render_batch_init(&server->render_batch);
+
+    /* Presentation feedback lets clients such as video players pace themselves
+     * against the actual refresh cycle of the output they are shown on. */
+    server->presentation = wlr_presentation_create(server->wl_display, server->backend);
+
+    /* Creates an output layout, which a wlroots utility for working with an
+	 * arrangement of screens in a physical layout. */
+    server->output_layout = wlr_output_layout_create();
+
+    wl_list_init(&server->outputs);
+    server->new_output.notify = new_output_notify;
+    wl_signal_add(&server->backend->events.new_output, &server->new_output);
+
+    /* Set up our list of views and the xdg-shell.
+	 * https://drewdevault.com/2018/07/29/Wayland-shells.html
+	 */
+    wl_list_init(&server->views);
+    view_index_init(&server->view_index);
+    server->stack_counter = 0;
+    server->xdg_shell = wlr_xdg_shell_create(server->wl_display);
+    server->new_xdg_surface.notify = server_new_xdg_surface;
+    wl_signal_add(&server->xdg_shell->events.new_surface, &server->new_xdg_surface);
+
+    configure_input(server);
+    stats_init(server);
+    event_ring_init(&server->event_ring, server->wl_event_loop, KAIJU_EVENT_RING_CAPACITY);
+    keybindings_init(&server->keybindings);
+    layout_init(&server->layout);
+    transaction_init(server);
+    frame_throttle_init(server);
+    server->bridge = NULL;
+
+    wl_display_init_shm(server->wl_display);
+    /* GPU clients hand us dmabufs, which are imported as textures (or even
+     * scanned out) without copying them. The formats and modifiers we
+     * advertise are whatever the renderer can import. */
+    server->linux_dmabuf = wlr_linux_dmabuf_v1_create(server->wl_display, server->renderer);
+    const struct wlr_drm_format_set *formats = wlr_renderer_get_dmabuf_formats(server->renderer);
+    if (formats == NULL || formats->len == 0) {
+        printf("Renderer can't import dmabufs, clients will fall back to shm\n");
+    } else {
+        printf("Advertising %zu dmabuf formats\n", formats->len);
+    }
+    wlr_gamma_control_manager_v1_create(server->wl_display);
+    wlr_screencopy_manager_v1_create(server->wl_display);
+    wlr_primary_selection_v1_device_manager_create(server->wl_display);
+    wlr_idle_create(server->wl_display);
+
+    server->compositor = wlr_compositor_create(
+            server->wl_display,
+            wlr_backend_get_renderer(server->backend)
+    );
+    client_stats_init(server);
+    wlr_data_device_manager_create(server->wl_display);
+}
+
+void server_set_bridge(struct kaiju_server *server, struct bridge_hooks *hooks) {
+    server->bridge = hooks;
+    server->event_ring.hooks = hooks;
+    if (hooks == NULL || hooks->keybindings == NULL) {
+        keybindings_compile(&server->keybindings, NULL, 0);
+    } else {
+        keybindings_compile(&server->keybindings, hooks->keybindings, hooks->keybinding_count);
+    }
+    if (hooks == NULL) return;
+
+    /* Records are only kept while a bridge is attached, so a bridge which
+     * attaches after startup or after a reload is told about everything that
+     * already exists first. */
+    struct kaiju_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        output_push_event(output, BRIDGE_EVENT_OUTPUT_ADD);
+    }
+    struct kaiju_view *view;
+    wl_list_for_each_reverse(view, &server->views, link) {
+        if (view->mapped) view_push_event(view, BRIDGE_EVENT_VIEW_MAP);
+    }
+    /* A new bridge may well want to arrange things differently */
+    layout_schedule(server);
+}
+
+void server_finish(struct kaiju_server *server) {
+    /* Nothing may call into the bridge while things are torn down */
+    server_set_bridge(server, NULL);
+
+    /* Destroying the display takes the backend, outputs and all client
+     * resources with it, so the pools are only torn down afterwards. */
+    stats_finish(server);
+    client_stats_finish(server);
+    event_ring_finish(&server->event_ring);
+    keybindings_finish(&server->keybindings);
+    layout_finish(&server->layout);
+    transaction_finish(server);
+    frame_throttle_finish(server);
+    wl_display_destroy_clients(server->wl_display);
+    /* Needs the renderer, which goes away with the display */
+    render_batch_finish(&server->render_batch);
+    wl_display_destroy(server->wl_display);
+    view_index_finish(&server->view_index);
+    free(server->cursor_image);
+    server->cursor_image = NULL;
+
+    pool_print_stats(&server->view_pool, stdout);
+    pool_print_stats(&server->popup_pool, stdout);
+    pool_print_stats(&server->subsurface_pool, stdout);
+    pool_print_stats(&server->output_pool, stdout);
+    pool_print_stats(&server->surface_pool, stdout);
+    pool_finish(&server->view_pool);
+    pool_finish(&server->popup_pool);
+    pool_finish(&server->subsurface_pool);
+    pool_finish(&server->output_pool);
+    pool_finish(&server->surface_pool);
+}
@@ -1,8 +1,11 @@
 #include <wayland-util.h>
 #include <wlr/types/wlr_keyboard.h>
 #include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/util/edges.h>
 #include "./include/kaiju_output.h"
 #include "./include/kaiju_server.h"
+#include "./include/output.h"
 #include "./include/shell/kaiju_view.h"
 
 void focus_view(struct kaiju_view *view, struct wlr_surface *surface) {
@@ -31,6 +34,10 @@ void focus_view(struct kaiju_view *view, struct wlr_surface *surface) {
     /* Move the view to the front */
     wl_list_remove(&view->link);
     wl_list_insert(&server->views, &view->link);
+    view->stack_order = ++server->stack_counter;
+    view_index_update(&server->view_index, view);
+    /* Parts of it might have been covered by other views until now */
+    view_damage(view, true);
     /* Activate the new surface */
     wlr_xdg_toplevel_set_activated(view->xdg_surface, true);
 
@@ -41,4 +48,163 @@ void focus_view(struct kaiju_view *view, struct wlr_surface *surface) {
      */
     wlr_seat_keyboard_notify_enter(seat, view->xdg_surface->surface,
                                    keyboard->keycodes, keyboard->num_keycodes, &keyboard->modifiers);
-}
\ No newline at end of file
+}
+
+struct view_damage_data {
+    struct kaiju_output *output;
+    struct kaiju_view *view;
+    bool whole;
+};
+
+static void view_damage_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    struct view_damage_data *ddata = data;
+    output_damage_surface(ddata->output, surface,
+                          ddata->view->props.x + sx, ddata->view->props.y + sy, ddata->whole);
+}
+
+void view_damage(struct kaiju_view *view, bool whole) {
+    struct kaiju_output *output;
+    wl_list_for_each(output, &view->server->outputs, link) {
+        struct view_damage_data ddata = {
+                .output = output,
+                .view = view,
+                .whole = whole,
+        };
+        wlr_xdg_surface_for_each_surface(view->xdg_surface, view_damage_iterator, &ddata);
+    }
+}
+
+struct surface_lookup_data {
+    struct wlr_surface *surface;
+    int sx, sy;
+    bool found;
+};
+
+static void surface_lookup_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    struct surface_lookup_data *ldata = data;
+    if (surface != ldata->surface) return;
+    ldata->sx = sx;
+    ldata->sy = sy;
+    ldata->found = true;
+}
+
+bool view_surface_coords(struct kaiju_view *view, struct wlr_surface *surface, int *sx, int *sy) {
+    /* Walking the surface tree gives us exactly the coordinates the surface is
+     * rendered at, popups and subsurfaces included. */
+    struct surface_lookup_data ldata = {
+            .surface = surface,
+    };
+    wlr_xdg_surface_for_each_surface(view->xdg_surface, surface_lookup_iterator, &ldata);
+    *sx = ldata.sx;
+    *sy = ldata.sy;
+    return ldata.found;
+}
+
+void view_set_fullscreen(struct kaiju_view *view, bool fullscreen, struct wlr_output *output) {
+    struct kaiju_server *server = view->server;
+    if (!view->mapped) {
+        /* Without a buffer there is no geometry to work out the position
+         * from yet, so this waits for the map */
+        view->fullscreen_requested = fullscreen;
+        return;
+    }
+
+    struct wlr_box geo_box;
+    wlr_xdg_surface_get_geometry(view->xdg_surface, &geo_box);
+    if (fullscreen && output == NULL) {
+        output = wlr_output_layout_output_at(server->output_layout,
+                                             view->props.x + geo_box.x + geo_box.width / 2.0,
+                                             view->props.y + geo_box.y + geo_box.height / 2.0);
+    }
+    if (fullscreen && output == NULL) {
+        /* The client still expects an answer, which is that nothing changed */
+        wlr_xdg_toplevel_set_fullscreen(view->xdg_surface, view->xdg_surface->toplevel->current.fullscreen);
+        wlr_xdg_surface_schedule_configure(view->xdg_surface);
+        return;
+    }
+
+    view_damage(view, true);
+    if (fullscreen) {
+        struct wlr_box *output_box = wlr_output_layout_get_box(server->output_layout, output);
+
+        if (!view->xdg_surface->toplevel->current.fullscreen) {
+            view->saved_geometry.x = view->props.x;
+            view->saved_geometry.y = view->props.y;
+            view->saved_geometry.width = geo_box.width;
+            view->saved_geometry.height = geo_box.height;
+        }
+        /* The window geometry may be inset from the surface, e.g. to leave
+         * room for client side shadows. */
+        view->props.x = output_box->x - geo_box.x;
+        view->props.y = output_box->y - geo_box.y;
+        wlr_xdg_toplevel_set_size(view->xdg_surface, output_box->width, output_box->height);
+    } else if (view->xdg_surface->toplevel->current.fullscreen) {
+        view->props.x = view->saved_geometry.x;
+        view->props.y = view->saved_geometry.y;
+        wlr_xdg_toplevel_set_size(view->xdg_surface,
+                                  view->saved_geometry.width, view->saved_geometry.height);
+    }
+    wlr_xdg_toplevel_set_fullscreen(view->xdg_surface, fullscreen);
+    view_index_update(&server->view_index, view);
+    view_damage(view, true);
+}
+
+static void view_send_resize(struct kaiju_view *view) {
+    view->resize_sent = view->resize_wanted;
+    view->resize_queued = false;
+    view->resize_serial = wlr_xdg_toplevel_set_size(view->xdg_surface,
+                                                    view->resize_sent.width, view->resize_sent.height);
+    if (view->resize_serial == 0) {
+        /* The size did not change, so there is no configure to wait for and
+         * the view can be moved right away. */
+        view_damage(view, true);
+        view->props.x = view->resize_sent.x;
+        view->props.y = view->resize_sent.y;
+        view_index_update(&view->server->view_index, view);
+        view_damage(view, true);
+    }
+}
+
+void view_resize(struct kaiju_view *view, struct wlr_box *geometry, uint32_t edges) {
+    view->resize_wanted = *geometry;
+    if (view->resize_wanted.width < 1) view->resize_wanted.width = 1;
+    if (view->resize_wanted.height < 1) view->resize_wanted.height = 1;
+    view->resize_edges = edges;
+    view->resize_queued = true;
+
+    /* Clients can't keep up with a configure per motion event. While one is
+     * outstanding, we only remember the latest size and send it afterwards. */
+    if (view->resize_serial == 0) {
+        view_send_resize(view);
+    }
+}
+
+bool view_commit_resize(struct kaiju_view *view) {
+    if (view->resize_serial == 0) return false;
+    /* configure_serial is the last serial the client acked. Serials wrap, so
+     * compare them the way wayland does. */
+    if ((int32_t) (view->xdg_surface->configure_serial - view->resize_serial) < 0) return false;
+
+    /* The client may have picked a different size than we asked for, e.g.
+     * because of its minimum size. Keep the edges which aren't being dragged
+     * where they are. */
+    struct wlr_box geo_box;
+    wlr_xdg_surface_get_geometry(view->xdg_surface, &geo_box);
+    int x = view->resize_sent.x, y = view->resize_sent.y;
+    if (view->resize_edges & WLR_EDGE_LEFT) x += view->resize_sent.width - geo_box.width;
+    if (view->resize_edges & WLR_EDGE_TOP) y += view->resize_sent.height - geo_box.height;
+    view->props.x = x;
+    view->props.y = y;
+    view->resize_serial = 0;
+
+    if (view->resize_queued) {
+        view_send_resize(view);
+    }
+    return true;
+}
+
+void view_invalidate_scene(struct kaiju_view *view) {
+    /* Serials are unique across views, so a view allocated where an old one
+     * was never matches the old one's nodes */
+    view->scene_serial = ++view->server->scene_serial;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <wayland-server-core.h>
+#include <wayland-util.h>
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include "./include/bridge/hooks.h"
+#include "./include/kaiju_server.h"
+#include "./include/shell/kaiju_view.h"
+#include "./include/shell/layout.h"
+
+void layout_init(struct kaiju_layout *layout) {
+    layout->idle = NULL;
+    wl_array_init(&layout->props);
+    wl_array_init(&layout->views);
+}
+
+void layout_finish(struct kaiju_layout *layout) {
+    if (layout->idle != NULL) {
+        wl_event_source_remove(layout->idle);
+        layout->idle = NULL;
+    }
+    wl_array_release(&layout->props);
+    wl_array_release(&layout->views);
+}
+
+static uint32_t view_flags(struct kaiju_view *view) {
+    uint32_t flags = 0;
+    if (view->server->seat->keyboard_state.focused_surface == view->xdg_surface->surface) {
+        flags |= VIEW_FLAG_FOCUSED;
+    }
+    if (view->xdg_surface->toplevel->current.fullscreen) flags |= VIEW_FLAG_FULLSCREEN;
+    return flags;
+}
+
+static void layout_collect(struct kaiju_server *server) {
+    struct kaiju_layout *layout = &server->layout;
+    layout->props.size = 0;
+    layout->views.size = 0;
+
+    struct kaiju_view *view;
+    wl_list_for_each(view, &server->views, link) {
+        if (!view->mapped) continue;
+        struct wlr_box geo_box;
+        wlr_xdg_surface_get_geometry(view->xdg_surface, &geo_box);
+
+        struct view_props *props = wl_array_add(&layout->props, sizeof(struct view_props));
+        *props = view->props;
+        props->width = geo_box.width;
+        props->height = geo_box.height;
+        props->flags = view_flags(view);
+        struct kaiju_view **entry = wl_array_add(&layout->views, sizeof(struct kaiju_view *));
+        *entry = view;
+    }
+}
+
+static void layout_apply(struct kaiju_server *server) {
+    /* Everything goes into one transaction, so that all views move within
+     * the same frame once their clients have caught up. */
+    struct kaiju_layout *layout = &server->layout;
+    struct view_props *props = layout->props.data;
+    struct kaiju_view **views = layout->views.data;
+    size_t count = layout->views.size / sizeof(struct kaiju_view *);
+    struct kaiju_view *focus = NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        struct kaiju_view *view = views[i];
+        struct view_props *wanted = &props[i];
+        if (wanted->id != view->props.id) {
+            fprintf(stderr, "Layout entry %zu changed its id from %u to %u, ignoring it\n",
+                    i, view->props.id, wanted->id);
+            continue;
+        }
+        uint32_t flags = view_flags(view);
+        if ((wanted->flags ^ flags) & VIEW_FLAG_FULLSCREEN) {
+            view_set_fullscreen(view, wanted->flags & VIEW_FLAG_FULLSCREEN, NULL);
+            continue;
+        }
+        if ((wanted->flags & VIEW_FLAG_FOCUSED) && !(flags & VIEW_FLAG_FOCUSED)) {
+            focus = view;
+        }
+        if (flags & VIEW_FLAG_FULLSCREEN) continue;
+
+        struct wlr_box geo_box;
+        wlr_xdg_surface_get_geometry(view->xdg_surface, &geo_box);
+        if (wanted->x == view->props.x && wanted->y == view->props.y &&
+            wanted->width == geo_box.width && wanted->height == geo_box.height) {
+            continue;
+        }
+        struct wlr_box geometry = {
+                .x = wanted->x,
+                .y = wanted->y,
+                .width = wanted->width,
+                .height = wanted->height,
+        };
+        transaction_add(view, &geometry);
+    }
+
+    transaction_start(server);
+    if (focus != NULL) focus_view(focus, focus->xdg_surface->surface);
+}
+
+static void layout_run(void *data) {
+    struct kaiju_server *server = data;
+    server->layout.idle = NULL;
+    if (server->bridge == NULL || server->bridge->onLayout == NULL) return;
+    if (transaction_active(server)) {
+        /* Views would be laid out based on where they are about to leave */
+        server->transaction.layout_deferred = true;
+        return;
+    }
+
+    layout_collect(server);
+    size_t count = server->layout.props.size / sizeof(struct view_props);
+    if (count == 0) return;
+    /* Layouts depend on the outputs the bridge knows about, so it gets to
+     * see every pending record first */
+    event_ring_drain(&server->event_ring);
+    server->bridge->onLayout(server->layout.props.data, count);
+    layout_apply(server);
+}
+
+void layout_schedule(struct kaiju_server *server) {
+    if (server->bridge == NULL || server->bridge->onLayout == NULL) return;
+    if (server->layout.idle != NULL) return;
+    server->layout.idle = wl_event_loop_add_idle(server->wl_event_loop, layout_run, server);
+}
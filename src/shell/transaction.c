@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server-core.h>
+#include <wayland-util.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include "./include/kaiju_server.h"
+#include "./include/shell/kaiju_view.h"
+#include "./include/shell/layout.h"
+#include "./include/shell/transaction.h"
+
+static int transaction_parse_timeout(void) {
+    const char *value = getenv("KAIJU_TRANSACTION_TIMEOUT");
+    if (value == NULL) return KAIJU_TRANSACTION_TIMEOUT_MS;
+    char *end;
+    long timeout = strtol(value, &end, 10);
+    if (*end != '\0' || timeout <= 0) {
+        fprintf(stderr, "Invalid KAIJU_TRANSACTION_TIMEOUT '%s', using %d ms\n",
+                value, KAIJU_TRANSACTION_TIMEOUT_MS);
+        return KAIJU_TRANSACTION_TIMEOUT_MS;
+    }
+    return (int) timeout;
+}
+
+static void transaction_apply(struct kaiju_server *server) {
+    /* Move every view in one go. The repaint this causes is the first one
+     * since the transaction started, so it shows the complete new layout. */
+    struct kaiju_transaction *transaction = &server->transaction;
+    struct kaiju_view *view, *tmp;
+    wl_list_for_each_safe(view, tmp, &transaction->views, transaction_link) {
+        view_damage(view, true);
+        view->props.x = view->transaction_geometry.x;
+        view->props.y = view->transaction_geometry.y;
+        view_index_update(&server->view_index, view);
+        view_damage(view, true);
+        wl_list_remove(&view->transaction_link);
+        wl_list_init(&view->transaction_link);
+        view->transaction_waiting = false;
+    }
+
+    transaction->active = false;
+    transaction->waiting = 0;
+    wl_event_source_timer_update(transaction->timeout, 0);
+    if (transaction->layout_deferred) {
+        transaction->layout_deferred = false;
+        layout_schedule(server);
+    }
+}
+
+static int transaction_handle_timeout(void *data) {
+    struct kaiju_server *server = data;
+    struct kaiju_transaction *transaction = &server->transaction;
+    fprintf(stderr, "Layout transaction timed out after %d ms with %zu views still resizing\n",
+            transaction->timeout_ms, transaction->waiting);
+    transaction_apply(server);
+    return 0;
+}
+
+void transaction_init(struct kaiju_server *server) {
+    struct kaiju_transaction *transaction = &server->transaction;
+    memset(transaction, 0, sizeof(struct kaiju_transaction));
+    wl_list_init(&transaction->views);
+    transaction->timeout_ms = transaction_parse_timeout();
+    transaction->timeout = wl_event_loop_add_timer(server->wl_event_loop, transaction_handle_timeout, server);
+}
+
+void transaction_finish(struct kaiju_server *server) {
+    struct kaiju_transaction *transaction = &server->transaction;
+    struct kaiju_view *view, *tmp;
+    wl_list_for_each_safe(view, tmp, &transaction->views, transaction_link) {
+        wl_list_remove(&view->transaction_link);
+        wl_list_init(&view->transaction_link);
+    }
+    wl_event_source_remove(transaction->timeout);
+    transaction->timeout = NULL;
+}
+
+void transaction_add(struct kaiju_view *view, const struct wlr_box *geometry) {
+    struct kaiju_transaction *transaction = &view->server->transaction;
+    if (!wl_list_empty(&view->transaction_link)) {
+        /* Already part of it, the newer geometry wins */
+        if (view->transaction_waiting) transaction->waiting--;
+        wl_list_remove(&view->transaction_link);
+    }
+    wl_list_insert(transaction->views.prev, &view->transaction_link);
+    view->transaction_geometry = *geometry;
+
+    int width = geometry->width < 1 ? 1 : geometry->width;
+    int height = geometry->height < 1 ? 1 : geometry->height;
+    view->transaction_serial = wlr_xdg_toplevel_set_size(view->xdg_surface, width, height);
+    /* No configure is sent if the size stays the same, and then there is
+     * nothing to wait for. */
+    view->transaction_waiting = view->transaction_serial != 0;
+    if (view->transaction_waiting) transaction->waiting++;
+}
+
+void transaction_start(struct kaiju_server *server) {
+    struct kaiju_transaction *transaction = &server->transaction;
+    if (wl_list_empty(&transaction->views)) return;
+    if (transaction->waiting == 0) {
+        /* Nothing resizes, so the views can move right away */
+        transaction_apply(server);
+        return;
+    }
+    if (!transaction->active) {
+        transaction->active = true;
+        wl_event_source_timer_update(transaction->timeout, transaction->timeout_ms);
+    }
+}
+
+bool transaction_active(struct kaiju_server *server) {
+    return server->transaction.active;
+}
+
+bool transaction_holds_box(struct kaiju_server *server, const struct wlr_box *box) {
+    struct kaiju_transaction *transaction = &server->transaction;
+    if (!transaction->active || box == NULL) return false;
+    /* Both where the views are now, popups included, and where they are
+     * about to go */
+    struct wlr_box intersection;
+    struct kaiju_view *view;
+    wl_list_for_each(view, &transaction->views, transaction_link) {
+        if (view->indexed && wlr_box_intersection(&intersection, &view->index_box, box)) return true;
+        if (wlr_box_intersection(&intersection, &view->transaction_geometry, box)) return true;
+    }
+    return false;
+}
+
+static void transaction_view_done(struct kaiju_view *view) {
+    struct kaiju_transaction *transaction = &view->server->transaction;
+    view->transaction_waiting = false;
+    transaction->waiting--;
+    if (transaction->active && transaction->waiting == 0) {
+        transaction_apply(view->server);
+    }
+}
+
+void transaction_view_commit(struct kaiju_view *view) {
+    if (!view->transaction_waiting) return;
+    /* configure_serial is the last serial the client acked. Serials wrap, so
+     * compare them the way wayland does. */
+    if ((int32_t) (view->xdg_surface->configure_serial - view->transaction_serial) < 0) return;
+    transaction_view_done(view);
+}
+
+void transaction_remove_view(struct kaiju_view *view) {
+    if (wl_list_empty(&view->transaction_link)) return;
+    wl_list_remove(&view->transaction_link);
+    wl_list_init(&view->transaction_link);
+    if (view->transaction_waiting) transaction_view_done(view);
+}
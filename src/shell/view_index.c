@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-util.h>
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include "./include/shell/kaiju_view.h"
+#include "./include/shell/view_index.h"
+
+static int cell_coord(int l) {
+    /* Rounds towards negative infinity, as views can be left of or above the
+     * origin of the layout. */
+    return l >= 0 ? l / VIEW_INDEX_CELL_SIZE : -((-l + VIEW_INDEX_CELL_SIZE - 1) / VIEW_INDEX_CELL_SIZE);
+}
+
+static unsigned int cell_hash(int x, int y) {
+    return ((unsigned int) x * 73856093u ^ (unsigned int) y * 19349663u) % VIEW_INDEX_BUCKETS;
+}
+
+static struct view_index_cell *cell_find(struct view_index *index, int x, int y) {
+    struct view_index_cell *cell = index->buckets[cell_hash(x, y)];
+    while (cell != NULL && (cell->x != x || cell->y != y)) {
+        cell = cell->next;
+    }
+    return cell;
+}
+
+static struct view_index_cell *cell_get(struct view_index *index, int x, int y) {
+    struct view_index_cell *cell = cell_find(index, x, y);
+    if (cell != NULL) return cell;
+
+    unsigned int hash = cell_hash(x, y);
+    cell = calloc(1, sizeof(struct view_index_cell));
+    cell->x = x;
+    cell->y = y;
+    wl_array_init(&cell->views);
+    cell->next = index->buckets[hash];
+    index->buckets[hash] = cell;
+    return cell;
+}
+
+static void cell_destroy(struct view_index *index, struct view_index_cell *cell) {
+    struct view_index_cell **link = &index->buckets[cell_hash(cell->x, cell->y)];
+    while (*link != cell) {
+        link = &(*link)->next;
+    }
+    *link = cell->next;
+    wl_array_release(&cell->views);
+    free(cell);
+}
+
+static void cell_insert(struct view_index_cell *cell, struct kaiju_view *view) {
+    size_t count = cell->views.size / sizeof(struct kaiju_view *);
+    wl_array_add(&cell->views, sizeof(struct kaiju_view *));
+    struct kaiju_view **views = cell->views.data;
+
+    /* Cells rarely hold more than a handful of views, so a linear search for
+     * the insertion point is plenty. Views which were just raised end up at
+     * the front right away. */
+    size_t i = 0;
+    while (i < count && views[i]->stack_order > view->stack_order) i++;
+    memmove(&views[i + 1], &views[i], (count - i) * sizeof(struct kaiju_view *));
+    views[i] = view;
+}
+
+static void cell_remove(struct view_index *index, struct view_index_cell *cell, struct kaiju_view *view) {
+    size_t count = cell->views.size / sizeof(struct kaiju_view *);
+    struct kaiju_view **views = cell->views.data;
+    for (size_t i = 0; i < count; i++) {
+        if (views[i] != view) continue;
+        memmove(&views[i], &views[i + 1], (count - i - 1) * sizeof(struct kaiju_view *));
+        cell->views.size -= sizeof(struct kaiju_view *);
+        break;
+    }
+    if (cell->views.size == 0) cell_destroy(index, cell);
+}
+
+void view_index_init(struct view_index *index) {
+    memset(index->buckets, 0, sizeof(index->buckets));
+    index->serial = 0;
+}
+
+void view_index_finish(struct view_index *index) {
+    for (int i = 0; i < VIEW_INDEX_BUCKETS; i++) {
+        while (index->buckets[i] != NULL) {
+            cell_destroy(index, index->buckets[i]);
+        }
+    }
+}
+
+void view_index_remove(struct view_index *index, struct kaiju_view *view) {
+    if (!view->indexed) return;
+    struct wlr_box *box = &view->index_box;
+    int x1 = cell_coord(box->x), x2 = cell_coord(box->x + box->width - 1);
+    int y1 = cell_coord(box->y), y2 = cell_coord(box->y + box->height - 1);
+    for (int y = y1; y <= y2; y++) {
+        for (int x = x1; x <= x2; x++) {
+            struct view_index_cell *cell = cell_find(index, x, y);
+            if (cell != NULL) cell_remove(index, cell, view);
+        }
+    }
+    view->indexed = false;
+    index->serial++;
+}
+
+static void extents_iterator(struct wlr_surface *surface, int sx, int sy, void *data) {
+    struct wlr_box *extents = data;
+    int x1 = sx < extents->x ? sx : extents->x;
+    int y1 = sy < extents->y ? sy : extents->y;
+    int x2 = sx + surface->current.width;
+    int y2 = sy + surface->current.height;
+    if (extents->x + extents->width > x2) x2 = extents->x + extents->width;
+    if (extents->y + extents->height > y2) y2 = extents->y + extents->height;
+    *extents = (struct wlr_box) {x1, y1, x2 - x1, y2 - y1};
+}
+
+static bool view_bounds(struct kaiju_view *view, struct wlr_box *box) {
+    /* The bounds cover popups and subsurfaces as well, since they receive
+     * input too */
+    struct wlr_box extents = {0};
+    wlr_xdg_surface_for_each_surface(view->xdg_surface, extents_iterator, &extents);
+    if (extents.width <= 0 || extents.height <= 0) return false;
+    box->x = view->props.x + extents.x;
+    box->y = view->props.y + extents.y;
+    box->width = extents.width;
+    box->height = extents.height;
+    return true;
+}
+
+void view_index_update(struct view_index *index, struct kaiju_view *view) {
+    view_index_remove(index, view);
+    if (!view->mapped) return;
+
+    struct wlr_box *box = &view->index_box;
+    if (!view_bounds(view, box)) return;
+
+    int x1 = cell_coord(box->x), x2 = cell_coord(box->x + box->width - 1);
+    int y1 = cell_coord(box->y), y2 = cell_coord(box->y + box->height - 1);
+    for (int y = y1; y <= y2; y++) {
+        for (int x = x1; x <= x2; x++) {
+            cell_insert(cell_get(index, x, y), view);
+        }
+    }
+    view->indexed = true;
+    index->serial++;
+}
+
+void view_index_refresh(struct view_index *index, struct kaiju_view *view) {
+    if (!view->mapped) return;
+    struct wlr_box box;
+    bool has_bounds = view_bounds(view, &box);
+    if (has_bounds == view->indexed && (!has_bounds ||
+        (box.x == view->index_box.x && box.y == view->index_box.y &&
+         box.width == view->index_box.width && box.height == view->index_box.height))) {
+        return;
+    }
+    view_index_update(index, view);
+}
+
+static int floor_coord(double l) {
+    int i = (int) l;
+    return i > l ? i - 1 : i;
+}
+
+struct kaiju_view **view_index_candidates(struct view_index *index, double lx, double ly, size_t *count) {
+    struct view_index_cell *cell = cell_find(index, cell_coord(floor_coord(lx)), cell_coord(floor_coord(ly)));
+    if (cell == NULL) {
+        *count = 0;
+        return NULL;
+    }
+    *count = cell->views.size / sizeof(struct kaiju_view *);
+    return cell->views.data;
+}
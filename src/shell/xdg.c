@@ -2,29 +2,283 @@
 #include <wlr/types/wlr_keyboard.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_surface.h>
 #include "./include/kaiju_output.h"
 #include "./include/kaiju_server.h"
+#include "./include/output.h"
 #include "./include/shell/kaiju_view.h"
 #include "./include/shell/xdg.h"
 
+void view_push_event(struct kaiju_view *view, enum bridge_event_type type) {
+    struct bridge_event record = {
+            .type = type,
+            .time_msec = (uint32_t) (stats_now_nsec() / 1000000),
+            .data.view = {
+                    .id = view->props.id,
+                    .x = view->props.x,
+                    .y = view->props.y,
+                    .width = view->width,
+                    .height = view->height,
+            },
+    };
+    event_ring_push(&view->server->event_ring, &record, false);
+}
+
+static void subsurface_track(struct kaiju_view *view, struct wlr_subsurface *wlr_subsurface);
+
+static void subsurface_track_children(struct kaiju_view *view, struct wlr_surface *surface) {
+    struct wlr_subsurface *child;
+    wl_list_for_each(child, &surface->subsurfaces, parent_link) {
+        subsurface_track(view, child);
+    }
+}
+
+static void subsurface_destroy(struct wl_listener *listener, void *data) {
+    struct kaiju_subsurface *subsurface = wl_container_of(listener, subsurface, destroy);
+    if (subsurface->view != NULL) view_invalidate_scene(subsurface->view);
+    wl_list_remove(&subsurface->link);
+    wl_list_remove(&subsurface->destroy.link);
+    wl_list_remove(&subsurface->commit.link);
+    wl_list_remove(&subsurface->new_subsurface.link);
+    pool_free(&subsurface->server->subsurface_pool, subsurface);
+}
+
+static void subsurface_commit(struct wl_listener *listener, void *data) {
+    /* Desynchronized subsurfaces commit without their parent, so nothing
+     * else damages what they drew. Synchronized ones end up damaged twice,
+     * which is harmless. */
+    struct kaiju_subsurface *subsurface = wl_container_of(listener, subsurface, commit);
+    struct kaiju_view *view = subsurface->view;
+    if (view == NULL) return;
+    view_invalidate_scene(view);
+    if (!view->mapped) return;
+
+    view_index_refresh(&view->server->view_index, view);
+    struct wlr_surface *surface = subsurface->wlr_subsurface->surface;
+    int sx, sy;
+    if (!view_surface_coords(view, surface, &sx, &sy)) return;
+    struct kaiju_output *output;
+    wl_list_for_each(output, &view->server->outputs, link) {
+        output_damage_surface(output, surface, view->props.x + sx, view->props.y + sy, false);
+    }
+}
+
+static void subsurface_new_subsurface(struct wl_listener *listener, void *data) {
+    struct kaiju_subsurface *subsurface = wl_container_of(listener, subsurface, new_subsurface);
+    if (subsurface->view != NULL) subsurface_track(subsurface->view, data);
+}
+
+static void subsurface_track(struct kaiju_view *view, struct wlr_subsurface *wlr_subsurface) {
+    struct kaiju_subsurface *subsurface = pool_alloc(&view->server->subsurface_pool);
+    subsurface->server = view->server;
+    subsurface->view = view;
+    subsurface->wlr_subsurface = wlr_subsurface;
+    wl_list_insert(&view->subsurfaces, &subsurface->link);
+
+    subsurface->destroy.notify = subsurface_destroy;
+    wl_signal_add(&wlr_subsurface->events.destroy, &subsurface->destroy);
+    subsurface->commit.notify = subsurface_commit;
+    wl_signal_add(&wlr_subsurface->surface->events.commit, &subsurface->commit);
+    subsurface->new_subsurface.notify = subsurface_new_subsurface;
+    wl_signal_add(&wlr_subsurface->surface->events.new_subsurface, &subsurface->new_subsurface);
+
+    view_invalidate_scene(view);
+    subsurface_track_children(view, wlr_subsurface->surface);
+}
+
+static void view_new_subsurface(struct wl_listener *listener, void *data) {
+    struct kaiju_view *view = wl_container_of(listener, view, new_subsurface);
+    subsurface_track(view, data);
+}
+
+static void popup_new_subsurface(struct wl_listener *listener, void *data) {
+    struct kaiju_popup *popup = wl_container_of(listener, popup, new_subsurface);
+    subsurface_track(popup->view, data);
+}
+
 /* Called when the surface is mapped, or ready to display on-screen. */
 static void xdg_surface_map(struct wl_listener *listener, void *data) {
     struct kaiju_view *view = wl_container_of(listener, view, map);
     view->mapped = true;
+    view->width = view->xdg_surface->surface->current.width;
+    view->height = view->xdg_surface->surface->current.height;
     focus_view(view, view->xdg_surface->surface);
+    view_index_update(&view->server->view_index, view);
+    view_damage(view, true);
+    if (view->fullscreen_requested) {
+        view->fullscreen_requested = false;
+        view_set_fullscreen(view, true, NULL);
+    }
+    view_push_event(view, BRIDGE_EVENT_VIEW_MAP);
+    layout_schedule(view->server);
 }
 
 /* Called when the surface is unmapped, and should no longer be shown. */
 static void xdg_surface_unmap(struct wl_listener *listener, void *data) {
     struct kaiju_view *view = wl_container_of(listener, view, unmap);
     view->mapped = false;
+    view->occluded = false;
+    view_index_remove(&view->server->view_index, view);
+    transaction_remove_view(view);
+    /* The surface no longer has a buffer, so we damage the area it last
+     * occupied instead. */
+    struct wlr_box box = {
+            .x = view->props.x,
+            .y = view->props.y,
+            .width = view->width,
+            .height = view->height,
+    };
+    server_damage_box(view->server, &box);
+    view_push_event(view, BRIDGE_EVENT_VIEW_UNMAP);
+    layout_schedule(view->server);
 }
 
 /* Called when the surface is destroyed and should never be shown again. */
 static void xdg_surface_destroy(struct wl_listener *listener, void *data) {
     struct kaiju_view *view = wl_container_of(listener, view, destroy);
     wl_list_remove(&view->link);
-    free(view);
+    view_index_remove(&view->server->view_index, view);
+    transaction_remove_view(view);
+    wl_list_remove(&view->map.link);
+    wl_list_remove(&view->unmap.link);
+    wl_list_remove(&view->destroy.link);
+    wl_list_remove(&view->commit.link);
+    wl_list_remove(&view->request_move.link);
+    wl_list_remove(&view->request_resize.link);
+    wl_list_remove(&view->request_fullscreen.link);
+    wl_list_remove(&view->new_subsurface.link);
+    /* The subsurfaces may well outlive the xdg surface */
+    struct kaiju_subsurface *subsurface, *tmp;
+    wl_list_for_each_safe(subsurface, tmp, &view->subsurfaces, link) {
+        wl_list_remove(&subsurface->link);
+        wl_list_init(&subsurface->link);
+        subsurface->view = NULL;
+    }
+    pixman_region32_fini(&view->visible);
+    pool_free(&view->server->view_pool, view);
+}
+
+/* Called whenever the client commits new state for the toplevel surface. */
+static void xdg_surface_commit(struct wl_listener *listener, void *data) {
+    struct kaiju_view *view = wl_container_of(listener, view, commit);
+    view_invalidate_scene(view);
+    if (!view->mapped) return;
+    transaction_view_commit(view);
+
+    struct wlr_surface *surface = view->xdg_surface->surface;
+    struct wlr_box box = {
+            .x = view->props.x,
+            .y = view->props.y,
+            .width = view->width,
+            .height = view->height,
+    };
+    /* If this commit carries the size of an interactive resize, the view is
+     * moved to match in the same go, so both land in the same frame. */
+    bool moved = view_commit_resize(view);
+    if (moved || surface->current.width != view->width || surface->current.height != view->height) {
+        /* The view changed size or position, so both the old and new area
+         * are dirty. */
+        server_damage_box(view->server, &box);
+        view->width = surface->current.width;
+        view->height = surface->current.height;
+        view_index_update(&view->server->view_index, view);
+        view_damage(view, true);
+    } else {
+        /* Synchronized subsurfaces may have moved or changed size with this
+         * commit */
+        view_index_refresh(&view->server->view_index, view);
+        view_damage(view, false);
+    }
+}
+
+static void popup_update_box(struct kaiju_popup *popup) {
+    struct kaiju_view *view = popup->view;
+    struct wlr_surface *surface = popup->xdg_surface->surface;
+    int sx, sy;
+    if (!view_surface_coords(view, surface, &sx, &sy)) return;
+    popup->box.x = view->props.x + sx;
+    popup->box.y = view->props.y + sy;
+    popup->box.width = surface->current.width;
+    popup->box.height = surface->current.height;
+}
+
+static void xdg_popup_map(struct wl_listener *listener, void *data) {
+    struct kaiju_popup *popup = wl_container_of(listener, popup, map);
+    view_invalidate_scene(popup->view);
+    popup_update_box(popup);
+    view_index_update(&popup->view->server->view_index, popup->view);
+    server_damage_box(popup->view->server, &popup->box);
+}
+
+static void xdg_popup_unmap(struct wl_listener *listener, void *data) {
+    struct kaiju_popup *popup = wl_container_of(listener, popup, unmap);
+    view_invalidate_scene(popup->view);
+    server_damage_box(popup->view->server, &popup->box);
+    /* The popup is still part of the surface tree until this returns, so
+     * its bounds are only dropped on the next update of the view. This is
+     * harmless, as hit-testing checks the actual surfaces anyway. */
+}
+
+static void xdg_popup_commit(struct wl_listener *listener, void *data) {
+    struct kaiju_popup *popup = wl_container_of(listener, popup, commit);
+    view_invalidate_scene(popup->view);
+    if (!popup->xdg_surface->mapped) return;
+
+    struct wlr_surface *surface = popup->xdg_surface->surface;
+    if (surface->current.width != popup->box.width || surface->current.height != popup->box.height) {
+        server_damage_box(popup->view->server, &popup->box);
+        popup_update_box(popup);
+        view_index_update(&popup->view->server->view_index, popup->view);
+        server_damage_box(popup->view->server, &popup->box);
+        return;
+    }
+
+    struct kaiju_output *output;
+    wl_list_for_each(output, &popup->view->server->outputs, link) {
+        output_damage_surface(output, surface, popup->box.x, popup->box.y, false);
+    }
+}
+
+static void xdg_popup_destroy(struct wl_listener *listener, void *data) {
+    struct kaiju_popup *popup = wl_container_of(listener, popup, destroy);
+    view_invalidate_scene(popup->view);
+    wl_list_remove(&popup->new_subsurface.link);
+    wl_list_remove(&popup->map.link);
+    wl_list_remove(&popup->unmap.link);
+    wl_list_remove(&popup->destroy.link);
+    wl_list_remove(&popup->commit.link);
+    pool_free(&popup->view->server->popup_pool, popup);
+}
+
+static struct kaiju_view *popup_get_view(struct wlr_xdg_surface *xdg_surface) {
+    /* Popups can be nested, so walk up until we reach the toplevel. */
+    while (xdg_surface != NULL && xdg_surface->role == WLR_XDG_SURFACE_ROLE_POPUP) {
+        struct wlr_surface *parent = xdg_surface->popup->parent;
+        if (parent == NULL || !wlr_surface_is_xdg_surface(parent)) return NULL;
+        xdg_surface = wlr_xdg_surface_from_wlr_surface(parent);
+    }
+    return xdg_surface != NULL ? xdg_surface->data : NULL;
+}
+
+static void new_xdg_popup(struct kaiju_server *server, struct wlr_xdg_surface *xdg_surface) {
+    struct kaiju_view *view = popup_get_view(xdg_surface);
+    if (view == NULL) return;
+
+    struct kaiju_popup *popup = pool_alloc(&server->popup_pool);
+    popup->view = view;
+    popup->xdg_surface = xdg_surface;
+
+    popup->map.notify = xdg_popup_map;
+    wl_signal_add(&xdg_surface->events.map, &popup->map);
+    popup->unmap.notify = xdg_popup_unmap;
+    wl_signal_add(&xdg_surface->events.unmap, &popup->unmap);
+    popup->destroy.notify = xdg_popup_destroy;
+    wl_signal_add(&xdg_surface->events.destroy, &popup->destroy);
+    popup->commit.notify = xdg_popup_commit;
+    wl_signal_add(&xdg_surface->surface->events.commit, &popup->commit);
+    popup->new_subsurface.notify = popup_new_subsurface;
+    wl_signal_add(&xdg_surface->surface->events.new_subsurface, &popup->new_subsurface);
+    subsurface_track_children(view, xdg_surface->surface);
 }
 
 static void begin_interactive(struct kaiju_view *view, enum kaiju_cursor_mode mode, uint32_t edges) {
@@ -65,20 +319,37 @@ static void xdg_toplevel_request_resize(struct wl_listener *listener, void *data
     begin_interactive(view, KAIJU_CURSOR_RESIZE, event->edges);
 }
 
+static void xdg_toplevel_request_fullscreen(struct wl_listener *listener, void *data) {
+    // Invoked when a window asks to enter or leave fullscreen
+    struct wlr_xdg_toplevel_set_fullscreen_event *event = data;
+    struct kaiju_view *view = wl_container_of(listener, view, request_fullscreen);
+    view_set_fullscreen(view, event->fullscreen, event->output);
+}
+
 void server_new_xdg_surface(struct wl_listener *listener, void *data) {
     /* This event is raised when wlr_xdg_shell receives a new xdg surface from a
      * client, either a toplevel (application window) or popup. */
     fprintf(stdout, "New XDG surface\n");
     struct kaiju_server *server = wl_container_of(listener, server, new_xdg_surface);
     struct wlr_xdg_surface *xdg_surface = data;
+    if (xdg_surface->role == WLR_XDG_SURFACE_ROLE_POPUP) {
+        new_xdg_popup(server, xdg_surface);
+        return;
+    }
     if (xdg_surface->role != WLR_XDG_SURFACE_ROLE_TOPLEVEL) {
         return;
     }
 
     /* Allocate a kaiju_view for this surface */
-    struct kaiju_view *view = calloc(1, sizeof(struct kaiju_view));
+    struct kaiju_view *view = pool_alloc(&server->view_pool);
     view->server = server;
+    view->props.id = ++server->last_view_id;
     view->xdg_surface = xdg_surface;
+    xdg_surface->data = view;
+    pixman_region32_init(&view->visible);
+    wl_list_init(&view->transaction_link);
+    wl_list_init(&view->subsurfaces);
+    view_invalidate_scene(view);
 
     /* Listen to the various events it can emit */
     view->map.notify = xdg_surface_map;
@@ -87,6 +358,11 @@ void server_new_xdg_surface(struct wl_listener *listener, void *data) {
     wl_signal_add(&xdg_surface->events.unmap, &view->unmap);
     view->destroy.notify = xdg_surface_destroy;
     wl_signal_add(&xdg_surface->events.destroy, &view->destroy);
+    view->commit.notify = xdg_surface_commit;
+    wl_signal_add(&xdg_surface->surface->events.commit, &view->commit);
+    view->new_subsurface.notify = view_new_subsurface;
+    wl_signal_add(&xdg_surface->surface->events.new_subsurface, &view->new_subsurface);
+    subsurface_track_children(view, xdg_surface->surface);
 
     /* cotd */
     struct wlr_xdg_toplevel *toplevel = xdg_surface->toplevel;
@@ -94,7 +370,10 @@ void server_new_xdg_surface(struct wl_listener *listener, void *data) {
     wl_signal_add(&toplevel->events.request_move, &view->request_move);
     view->request_resize.notify = xdg_toplevel_request_resize;
     wl_signal_add(&toplevel->events.request_resize, &view->request_resize);
+    view->request_fullscreen.notify = xdg_toplevel_request_fullscreen;
+    wl_signal_add(&toplevel->events.request_fullscreen, &view->request_fullscreen);
 
     /* Add it to the list of views. */
     wl_list_insert(&server->views, &view->link);
-}
\ No newline at end of file
+    view->stack_order = ++server->stack_counter;
+}
@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server-core.h>
+#include <wayland-util.h>
+#include <wlr/types/wlr_output.h>
+
+#include "./include/kaiju_output.h"
+#include "./include/kaiju_server.h"
+#include "./include/stats.h"
+
+/* Input timestamps which are further off than this come from a different
+ * clock than ours, e.g. a nested backend, and are not worth recording. */
+#define STATS_MAX_INPUT_LATENCY 10000000000LL
+
+int64_t timespec_to_nsec(const struct timespec *t) {
+    return (int64_t) t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+int64_t stats_now_nsec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_to_nsec(&now);
+}
+
+static int histogram_bucket(int64_t nsec) {
+    int64_t usec = nsec / 1000;
+    int bucket = 0;
+    while (usec > 0 && bucket < KAIJU_HISTOGRAM_BUCKETS - 1) {
+        usec >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static int64_t histogram_bucket_limit(int bucket) {
+    return ((int64_t) 1 << bucket) * 1000;
+}
+
+void histogram_add(struct kaiju_histogram *histogram, int64_t nsec) {
+    if (nsec < 0) nsec = 0;
+    histogram->buckets[histogram_bucket(nsec)]++;
+    histogram->count++;
+    histogram->total += nsec;
+    if (nsec > histogram->max) histogram->max = nsec;
+}
+
+int64_t histogram_percentile(const struct kaiju_histogram *histogram, double percentile) {
+    if (histogram->count == 0) return 0;
+    uint64_t rank = (uint64_t) (histogram->count * percentile / 100.0);
+    uint64_t seen = 0;
+    for (int i = 0; i < KAIJU_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen > rank) {
+            /* The bucket limit might be above anything we have seen */
+            int64_t limit = histogram_bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void output_stats_commit(struct kaiju_output_stats *stats) {
+    stats->frames++;
+    clock_gettime(CLOCK_MONOTONIC, &stats->commit_time);
+    stats->commit_pending = true;
+}
+
+void output_stats_present(struct kaiju_output_stats *stats, const struct timespec *when, int refresh) {
+    /* A frame committed in time is presented at the very next vblank, so
+     * every further refresh cycle it had to wait was a missed vblank. */
+    int64_t present = timespec_to_nsec(when);
+    if (stats->commit_pending && refresh > 0) {
+        int64_t latency = present - timespec_to_nsec(&stats->commit_time);
+        if (latency > refresh) stats->missed_vblanks += latency / refresh;
+    }
+    if (stats->presented) {
+        histogram_add(&stats->frame_interval, present - timespec_to_nsec(&stats->last_present));
+    }
+    stats->commit_pending = false;
+    stats->last_present = *when;
+    stats->presented = true;
+}
+
+void stats_record_input(struct kaiju_server *server, uint32_t time_msec) {
+    /* Event timestamps only have millisecond precision and wrap around every
+     * 49 days, so we compare them against the low bits of our own clock. */
+    int64_t now = stats_now_nsec();
+    int64_t now_msec = now / 1000000;
+    int64_t latency = ((int64_t) (uint32_t) (now_msec - time_msec)) * 1000000 + now % 1000000;
+    if (latency > STATS_MAX_INPUT_LATENCY) return;
+    histogram_add(&server->input_latency, latency);
+}
+
+void stats_reset(struct kaiju_server *server) {
+    memset(&server->input_latency, 0, sizeof(server->input_latency));
+    client_stats_reset(server);
+    struct kaiju_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        memset(&output->stats, 0, sizeof(output->stats));
+    }
+}
+
+void stats_startup_mark(struct kaiju_server *server, const char *stage) {
+    if (server->startup_time == 0) return;
+    printf("Startup: %-20s +%.1f ms\n", stage, (stats_now_nsec() - server->startup_time) / 1e6);
+}
+
+static void histogram_write_json(const struct kaiju_histogram *histogram, FILE *file) {
+    fprintf(file, "{\"count\":%llu,\"avg_us\":%.1f,\"max_us\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"buckets\":[",
+            (unsigned long long) histogram->count,
+            histogram->count ? histogram->total / 1000.0 / histogram->count : 0.0,
+            histogram->max / 1000.0,
+            histogram_percentile(histogram, 50) / 1000.0,
+            histogram_percentile(histogram, 99) / 1000.0);
+    /* Only buckets with samples in them, as [upper bound in us, count] */
+    bool first = true;
+    for (int i = 0; i < KAIJU_HISTOGRAM_BUCKETS; i++) {
+        if (histogram->buckets[i] == 0) continue;
+        long long limit = i == KAIJU_HISTOGRAM_BUCKETS - 1 ? -1 : (long long) histogram_bucket_limit(i) / 1000;
+        fprintf(file, "%s[%lld,%llu]", first ? "" : ",", limit, (unsigned long long) histogram->buckets[i]);
+        first = false;
+    }
+    fprintf(file, "]}");
+}
+
+void stats_write_json(struct kaiju_server *server, FILE *file) {
+    fprintf(file, "{\"outputs\":[");
+    bool first = true;
+    struct kaiju_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        struct kaiju_output_stats *stats = &output->stats;
+        fprintf(file, "%s{\"name\":\"%s\",\"refresh_mhz\":%d,\"frames\":%llu,\"scanout_frames\":%llu,"
+                      "\"missed_vblanks\":%llu,\"hardware_cursor\":%s,\"software_cursor_frames\":%llu,"
+                      "\"cursor_fallbacks\":%llu,\"scene_builds\":%llu,\"scene_reuses\":%llu,\"draw_calls\":%llu,"
+                      "\"batched_frames\":%llu,\"render_time\":",
+                first ? "" : ",", output->wlr_output->name, output->wlr_output->refresh,
+                (unsigned long long) stats->frames, (unsigned long long) stats->scanout_frames,
+                (unsigned long long) stats->missed_vblanks, output->hardware_cursor ? "true" : "false",
+                (unsigned long long) stats->software_cursor_frames,
+                (unsigned long long) stats->cursor_fallbacks,
+                (unsigned long long) stats->scene_builds, (unsigned long long) stats->scene_reuses,
+                (unsigned long long) stats->draw_calls, (unsigned long long) stats->batched_frames);
+        histogram_write_json(&stats->render_time, file);
+        /* The renderer gives us no way to put timer queries around a frame */
+        fprintf(file, ",\"gpu_time\":null,\"frame_interval\":");
+        histogram_write_json(&stats->frame_interval, file);
+        fprintf(file, "}");
+        first = false;
+    }
+    fprintf(file, "],\"input_latency\":");
+    histogram_write_json(&server->input_latency, file);
+    fprintf(file, ",\"cursor\":{\"image_sets\":%llu,\"image_skips\":%llu}",
+            (unsigned long long) server->cursor_image_sets, (unsigned long long) server->cursor_image_skips);
+    fprintf(file, ",\"clients\":");
+    client_stats_write_json(server, file);
+    struct bridge_event_ring *ring = server->event_ring.shared;
+    if (ring != NULL) {
+        fprintf(file, ",\"event_ring\":{\"capacity\":%u,\"produced\":%llu,\"dropped\":%llu,\"stalls\":%llu}",
+                ring->capacity, (unsigned long long) ring->produced,
+                (unsigned long long) ring->dropped, (unsigned long long) ring->stalls);
+    }
+    fprintf(file, "}\n");
+    fflush(file);
+}
+
+static int stats_handle_signal(int signal_number, void *data) {
+    /* KAIJU_STATS_FILE names a file to write to instead of stdout. It is
+     * rewritten on every dump, so that it always holds a single object. */
+    struct kaiju_server *server = data;
+    const char *path = getenv("KAIJU_STATS_FILE");
+    if (path == NULL) {
+        stats_write_json(server, stdout);
+        return 0;
+    }
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror("Failed to open KAIJU_STATS_FILE");
+        return 0;
+    }
+    stats_write_json(server, file);
+    fclose(file);
+    return 0;
+}
+
+void stats_init(struct kaiju_server *server) {
+    memset(&server->input_latency, 0, sizeof(server->input_latency));
+    server->stats_signal = wl_event_loop_add_signal(server->wl_event_loop, SIGUSR1,
+                                                    stats_handle_signal, server);
+}
+
+void stats_finish(struct kaiju_server *server) {
+    if (server->stats_signal != NULL) {
+        wl_event_source_remove(server->stats_signal);
+        server->stats_signal = NULL;
+    }
+}